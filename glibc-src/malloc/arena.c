@@ -195,6 +195,10 @@ __malloc_fork_unlock_parent (void)
 void
 __malloc_fork_unlock_child (void)
 {
+  /* Only the forking thread survives; release the profiler records of
+     the others.  */
+  mprof_fork_child ();
+
   /* Push all arenas to the free list, except thread_arena, which is
      attached to the current thread.  */
   __libc_lock_init (free_list_lock);
@@ -882,6 +886,9 @@ arena_get_retry (mstate ar_ptr, size_t bytes)
 void
 __malloc_arena_thread_freeres (void)
 {
+  /* Flush this thread's profile while malloc is still fully usable.  */
+  mprof_thread_exit ();
+
   /* Shut down the thread cache first.  This could deallocate data for
      the thread arena, so do this before we put the arena on the free
      list.  */
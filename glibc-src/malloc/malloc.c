@@ -261,7 +261,269 @@
 #include <sys/random.h>
 #include <not-cancel.h>
 
-#include "malloc_prof.h"
+#include <stdbool.h>
+
+/*
+  Sampling allocation profiler (configure --enable-malloc-profiler).
+
+  void *mprof_on_alloc (bool prof, size_t bytes, void *mem)
+
+  Report a request for BYTES that returned MEM to the profiler and
+  return MEM.  NULL results are ignored.  It is always inlined into the
+  public entry points, so the return address it records is that of the
+  application's call site.  PROF is a compile-time constant: each entry
+  point is built twice from an always-inline body, once with PROF true
+  and once with it false, and the public symbol is an IFUNC that picks
+  one at startup from the glibc.malloc.profile tunable (see
+  mprof_ifunc).  With profiling off the process runs the plain
+  allocator, without even a test of whether profiling is enabled.
+
+  The memalign family is built once and always passes PROF true.  A
+  request relayed to malloc (alignment <= MALLOC_ALIGNMENT) goes to
+  mprof_inner_malloc, so it is reported once, at the caller.
+
+  void *mprof_on_alloc2 (bool prof, size_t bytes, void *mem, bool large)
+
+  mprof_on_alloc for paths that bypass the tcache, with LARGE set to
+  mprof_is_large (bytes).  Large requests (GLIBC_MALLOC_PROFILE_LARGE,
+  by default at least mp_.mmap_threshold) are recorded exactly instead
+  of being sampled.  The test is a macro because mp_ is defined further
+  down, and it stays off the tcache paths.
+
+  void *mprof_on_calloc (bool prof, size_t bytes, void *mem,
+			 size_t cleared)
+
+  Like mprof_on_alloc for calloc, which also says how many bytes it
+  had to zero: none for fresh mmapped or sbrked memory, which the
+  kernel has cleared already.  mprof_on_calloc2 is its counterpart of
+  mprof_on_alloc2.
+
+  void mprof_on_free (bool prof, void *mem)
+
+  Tell the profiler that MEM is no longer allocated, so it can keep its
+  set of live sampled allocations (GLIBC_MALLOC_PROFILE_LIVE) current.
+  Unless that set may hold the pointer, this is a load and a branch.
+
+  void *mprof_on_realloc (bool prof, void *oldmem, size_t bytes,
+			  void *newmem, const struct mprof_realloc *r)
+
+  Report a successful realloc of OLDMEM to BYTES that returned NEWMEM,
+  and return NEWMEM.  R says how the old block was resized and how
+  many bytes were copied; __libc_realloc_impl fills it in as it goes.
+  The profiler samples reallocs by their new size, like allocations,
+  records large ones exactly (see mprof_on_alloc2), and drops OLDMEM
+  from its live set.
+
+  mprof_inner_malloc (bytes)
+
+  malloc for use inside an entry point that reports the request
+  itself, so that it is not counted twice.
+
+  void mprof_heap_grow (void)
+
+  Called where the heap may have grown (system_mem of an arena or the
+  mmapped total), with the arena lock held.  If growth snapshots are
+  enabled (GLIBC_MALLOC_PROFILE_GROWTH_*) and the heap has passed the
+  profiler's next threshold, the profiler is told the new size; it
+  captures the snapshot later, from an allocation with no lock held,
+  and writes it outside any allocating call.
+
+  void mprof_thread_exit (void)
+  void mprof_fork_child (void)
+
+  Flush the calling thread's profile before it exits, and drop the
+  profiler state of threads that did not survive a fork.
+
+  void mprof_tcache (tcache_perthread_struct *tc)
+
+  Register the calling thread's new tcache TC with the profiler, or
+  with TC NULL unregister it before it is freed.  The thread cache
+  report (GLIBC_MALLOC_PROFILE_TCACHE) reads the registered caches'
+  counters through __malloc_tcache_bins without stopping their threads.
+
+  void mprof_info (FILE *fp, bool json)
+
+  Append the profiler's section to malloc_info output: stride, sample
+  and overflow counts, self-overhead and the top sites by estimated
+  bytes, as XML elements or as a "profiler" JSON member.
+
+  When the profiler is not configured in, all of these are empty and
+  the allocator compiles to the same code as without the profiler.
+*/
+
+/* How realloc resized the old block.  The values are the profiler's
+   MP_REALLOC_* codes.  */
+enum mprof_realloc_kind
+{
+  mprof_realloc_new,		/* realloc (NULL, n): a plain allocation */
+  mprof_realloc_in_place,	/* same address, nothing copied */
+  mprof_realloc_mremap,		/* mmapped chunk resized by mremap_chunk */
+  mprof_realloc_copy		/* new chunk, old contents copied */
+};
+
+struct mprof_realloc
+{
+  size_t old_size;		/* usable size of the old block */
+  size_t copied;		/* bytes copied, for mprof_realloc_copy */
+  enum mprof_realloc_kind kind;
+};
+
+static __always_inline void
+mprof_realloc_note (struct mprof_realloc *r, enum mprof_realloc_kind kind,
+		    size_t copied)
+{
+  r->kind = kind;
+  r->copied = copied;
+}
+
+#if defined USE_MALLOC_PROF && IS_IN (libc)
+# include "malloc_prof.h"
+
+static __always_inline void *
+mprof_on_alloc (bool prof, size_t bytes, void *mem)
+{
+  if (prof && mem != NULL)
+    __mp_on_alloc (bytes, mem, __builtin_return_address (0));
+  return mem;
+}
+
+static __always_inline void *
+mprof_on_alloc2 (bool prof, size_t bytes, void *mem, bool large)
+{
+  if (prof && mem != NULL)
+    {
+      if (large)
+	__mp_on_large (bytes, mem, false, 0, __builtin_return_address (0));
+      else
+	__mp_on_alloc (bytes, mem, __builtin_return_address (0));
+    }
+  return mem;
+}
+
+static __always_inline void *
+mprof_on_calloc (bool prof, size_t bytes, void *mem, size_t cleared)
+{
+  if (prof && mem != NULL)
+    __mp_on_calloc (bytes, mem, cleared, __builtin_return_address (0));
+  return mem;
+}
+
+static __always_inline void *
+mprof_on_calloc2 (bool prof, size_t bytes, void *mem, size_t cleared,
+		  bool large)
+{
+  if (prof && mem != NULL)
+    {
+      if (large)
+	__mp_on_large (bytes, mem, true, cleared,
+		       __builtin_return_address (0));
+      else
+	__mp_on_calloc (bytes, mem, cleared, __builtin_return_address (0));
+    }
+  return mem;
+}
+
+# define mprof_is_large(bytes) \
+  (__glibc_unlikely (__mp_large_bytes != SIZE_MAX)			      \
+   && (bytes) >= (__mp_large_bytes != 0					      \
+		  ? __mp_large_bytes : mp_.mmap_threshold))
+
+static __always_inline void
+mprof_on_free (bool prof, void *mem)
+{
+  if (prof)
+    {
+      const uint8_t *filter = __mp_live_filter;
+      if (__glibc_unlikely (filter != NULL)
+	  && filter[mp_live_filter_index (mem)] != 0)
+	__mp_on_free (mem);
+    }
+}
+
+static __always_inline void *
+mprof_on_realloc (bool prof, void *oldmem, size_t bytes, void *newmem,
+		  const struct mprof_realloc *r)
+{
+  if (prof && newmem != NULL)
+    __mp_on_realloc (oldmem, newmem, bytes, r->old_size, r->kind, r->copied,
+		     mprof_is_large (bytes), __builtin_return_address (0));
+  return newmem;
+}
+
+static void mprof_heap_grow (void);
+
+# define mprof_inner_malloc(bytes) __libc_malloc_impl (bytes, false)
+
+# define mprof_thread_exit() __mp_on_thread_exit ()
+# define mprof_fork_child() __mp_on_fork_child ()
+# define mprof_tcache(tc) __mp_on_tcache (tc)
+# define mprof_info(fp, json) __mp_info (fp, json)
+
+# if HAVE_IFUNC
+#  define MPROF_IFUNC 1
+
+/* The resolvers need no CPU features.  */
+#  define INIT_ARCH()
+
+/* Define NAME as an IFUNC selecting IMPL or its unprofiled twin
+   IMPL##_noprof.  Tunables are parsed before IRELATIVE relocations are
+   applied, in both static and dynamic links, so the choice is made
+   once and costs nothing afterwards.  */
+#  define mprof_ifunc(name, impl) \
+  libc_ifunc (name, (TUNABLE_GET (profile, int32_t, NULL) != 0		      \
+		     ? impl : impl##_noprof))
+# endif
+#else
+static __always_inline void *
+mprof_on_alloc (bool prof, size_t bytes, void *mem)
+{
+  return mem;
+}
+
+static __always_inline void *
+mprof_on_alloc2 (bool prof, size_t bytes, void *mem, bool large)
+{
+  return mem;
+}
+
+static __always_inline void *
+mprof_on_calloc (bool prof, size_t bytes, void *mem, size_t cleared)
+{
+  return mem;
+}
+
+static __always_inline void *
+mprof_on_calloc2 (bool prof, size_t bytes, void *mem, size_t cleared,
+		  bool large)
+{
+  return mem;
+}
+
+# define mprof_is_large(bytes) false
+
+static __always_inline void
+mprof_on_free (bool prof, void *mem)
+{
+}
+
+static __always_inline void *
+mprof_on_realloc (bool prof, void *oldmem, size_t bytes, void *newmem,
+		  const struct mprof_realloc *r)
+{
+  return newmem;
+}
+
+# define mprof_heap_grow() ((void) 0)
+# define mprof_inner_malloc(bytes) __libc_malloc (bytes)
+# define mprof_thread_exit() ((void) 0)
+# define mprof_fork_child() ((void) 0)
+# define mprof_tcache(tc) ((void) 0)
+# define mprof_info(fp, json) ((void) 0)
+#endif
+
+#ifndef MPROF_IFUNC
+# define MPROF_IFUNC 0
+#endif
 
 /*
   Debugging:
@@ -599,7 +861,7 @@ tag_at (void *ptr)
 void *__libc_malloc (size_t);
 libc_hidden_proto (__libc_malloc)
 
-static void *__libc_calloc2 (size_t);
+static void *__libc_calloc2 (size_t, size_t *);
 static void *__libc_malloc2 (size_t);
 
 /*
@@ -1863,6 +2125,35 @@ get_max_fast (void)
  */
 
 
+/*
+   Arena counters are kept where chunks leave and re-enter an arena:
+   in _int_malloc (including chunks it moves into the tcache), in
+   _int_realloc and _int_memalign when they resize a chunk in place,
+   and in _int_free_chunk.  They are only written with the arena lock
+   held.  Fastbin frees may happen without it, so a chunk freed to a
+   fastbin still counts as in use, like one in a tcache, until
+   _int_malloc hands it out again or malloc_consolidate drains it.
+   Readers load each counter on its own, so a snapshot can be off by
+   the operations in flight.
+
+   The counters cost stores on the allocation paths, so they are only
+   kept in builds configured with --enable-malloc-profiler.
+*/
+
+#if defined USE_MALLOC_PROF && IS_IN (libc)
+# define MALLOC_ARENA_COUNTERS 1
+
+struct malloc_arena_counters
+{
+  INTERNAL_SIZE_T allocs;		/* chunks handed out */
+  INTERNAL_SIZE_T frees;		/* chunks taken back */
+  INTERNAL_SIZE_T in_use;		/* bytes handed out minus those taken
+					   back */
+};
+#else
+# define MALLOC_ARENA_COUNTERS 0
+#endif
+
 struct malloc_state
 {
   /* Serialize access.  */
@@ -1905,6 +2196,12 @@ struct malloc_state
   /* Memory allocated from the system in this arena.  */
   INTERNAL_SIZE_T system_mem;
   INTERNAL_SIZE_T max_system_mem;
+
+#if MALLOC_ARENA_COUNTERS
+  /* Approximate statistics for malloc_arena_stats, which reads them
+     without the arena lock.  */
+  struct malloc_arena_counters counters;
+#endif
 };
 
 struct malloc_par
@@ -1965,6 +2262,74 @@ static struct malloc_state main_arena =
   .attached_threads = 1
 };
 
+/* The arena counter helpers below must be called with AV's lock
+   held.  */
+#if MALLOC_ARENA_COUNTERS
+/* Count a chunk of SIZE bytes handed out by AV.  */
+static __always_inline void
+arena_count_alloc (mstate av, INTERNAL_SIZE_T size)
+{
+  atomic_store_relaxed (&av->counters.allocs, av->counters.allocs + 1);
+  atomic_store_relaxed (&av->counters.in_use, av->counters.in_use + size);
+}
+
+/* Count a chunk taken from a fastbin and handed out again: it was
+   freed, but its bytes never stopped counting as in use.  */
+static __always_inline void
+arena_count_reuse (mstate av)
+{
+  atomic_store_relaxed (&av->counters.frees, av->counters.frees + 1);
+  atomic_store_relaxed (&av->counters.allocs, av->counters.allocs + 1);
+}
+
+/* Count SIZE more bytes in a chunk that AV has handed out already.  */
+static __always_inline void
+arena_count_grow (mstate av, INTERNAL_SIZE_T size)
+{
+  atomic_store_relaxed (&av->counters.in_use, av->counters.in_use + size);
+}
+
+/* Count a chunk coming back to AV, whose bytes are released by
+   arena_count_release as it is merged into the bins or top.  */
+static __always_inline void
+arena_count_free (mstate av)
+{
+  atomic_store_relaxed (&av->counters.frees, av->counters.frees + 1);
+}
+
+/* Count SIZE bytes of a chunk going back to AV's bins or top.  */
+static __always_inline void
+arena_count_release (mstate av, INTERNAL_SIZE_T size)
+{
+  atomic_store_relaxed (&av->counters.in_use, av->counters.in_use - size);
+}
+#else
+static __always_inline void
+arena_count_alloc (mstate av, INTERNAL_SIZE_T size)
+{
+}
+
+static __always_inline void
+arena_count_reuse (mstate av)
+{
+}
+
+static __always_inline void
+arena_count_grow (mstate av, INTERNAL_SIZE_T size)
+{
+}
+
+static __always_inline void
+arena_count_free (mstate av)
+{
+}
+
+static __always_inline void
+arena_count_release (mstate av, INTERNAL_SIZE_T size)
+{
+}
+#endif
+
 /* There is only one instance of the malloc parameters.  */
 
 static struct malloc_par mp_ =
@@ -2443,6 +2808,30 @@ do_check_malloc_state (mstate av)
 
 /* ----------- Routines dealing with system allocation -------------- */
 
+#if defined USE_MALLOC_PROF && IS_IN (libc)
+/* Sum system_mem over all arenas without their locks; the result only
+   decides when to take a profile, so a slightly stale value is fine.  */
+static void
+mprof_heap_grow (void)
+{
+  size_t next = atomic_load_relaxed (&__mp_growth_next);
+  if (__glibc_likely (next == SIZE_MAX))
+    return;
+
+  size_t total = atomic_load_relaxed (&mp_.mmapped_mem);
+  mstate a = &main_arena;
+  do
+    {
+      total += atomic_load_relaxed (&a->system_mem);
+      a = atomic_load_relaxed (&a->next);
+    }
+  while (a != &main_arena);
+
+  if (total >= next)
+    __mp_on_heap_grow (total);
+}
+#endif
+
 /* Allocate a mmap chunk - used for large block sizes or as a fallback.
    Round up size to nearest page.  Add padding if MALLOC_ALIGNMENT is
    larger than CHUNK_HDR_SZ.  Add CHUNK_HDR_SZ at the end so that mmap
@@ -2473,6 +2862,7 @@ sysmalloc_mmap (INTERNAL_SIZE_T nb, size_t pagesize, int extra_flags)
   unsigned long sum;
   sum = atomic_fetch_add_relaxed (&mp_.mmapped_mem, size) + size;
   atomic_max (&mp_.max_mmapped_mem, sum);
+  mprof_heap_grow ();
 
   check_chunk (NULL, p);
 
@@ -2625,6 +3015,8 @@ sysmalloc (INTERNAL_SIZE_T nb, mstate av)
 			CHUNK_HDR_SZ | PREV_INUSE);
               set_foot (chunk_at_offset (old_top, old_size), CHUNK_HDR_SZ);
               set_head (old_top, old_size | PREV_INUSE | NON_MAIN_ARENA);
+              /* Freeing the old top must not lower the in-use count.  */
+              arena_count_alloc (av, chunksize (old_top));
               _int_free_chunk (av, old_top, chunksize (old_top), 1);
             }
           else
@@ -2896,6 +3288,7 @@ sysmalloc (INTERNAL_SIZE_T nb, mstate av)
                       /* If possible, release the rest. */
                       if (old_size >= MINSIZE)
                         {
+                          arena_count_alloc (av, chunksize (old_top));
                           _int_free_chunk (av, old_top, chunksize (old_top), 1);
                         }
                     }
@@ -2906,6 +3299,7 @@ sysmalloc (INTERNAL_SIZE_T nb, mstate av)
 
   if ((unsigned long) av->system_mem > (unsigned long) (av->max_system_mem))
     av->max_system_mem = av->system_mem;
+  mprof_heap_grow ();
   check_malloc_state (av);
 
   /* finally, do the allocation */
@@ -3075,6 +3469,7 @@ mremap_chunk (mchunkptr p, size_t new_size)
   new = atomic_fetch_add_relaxed (&mp_.mmapped_mem, new_size - size - offset)
         + new_size - size - offset;
   atomic_max (&mp_.max_mmapped_mem, new);
+  mprof_heap_grow ();
   return p;
 }
 #endif /* HAVE_MREMAP */
@@ -3387,6 +3782,9 @@ tcache_thread_shutdown (void)
   if (! need_free)
     return;
 
+  /* Wait for a profiler report that may be reading the counters.  */
+  mprof_tcache (NULL);
+
   /* Free all of the entries and the tcache itself back to the arena
      heap for coalescing.  */
   for (i = 0; i < TCACHE_MAX_BINS; ++i)
@@ -3432,6 +3830,7 @@ tcache_init (mstate av)
       memset (tcache, 0, bytes);
       for (int i = 0; i < TCACHE_MAX_BINS; i++)
 	tcache->num_slots[i] = mp_.tcache_count;
+      mprof_tcache (tcache);
     }
 }
 
@@ -3483,10 +3882,9 @@ __libc_malloc2 (size_t bytes)
   return victim;
 }
 
-void *
-__libc_malloc (size_t bytes)
+static __always_inline void *
+__libc_malloc_impl (size_t bytes, bool prof)
 {
-  void* result;
 #if USE_TCACHE
   size_t nb = checked_request2size (bytes);
 
@@ -3496,37 +3894,39 @@ __libc_malloc (size_t bytes)
 
       if (__glibc_likely (tc_idx < TCACHE_SMALL_BINS))
         {
-	  if (tcache->entries[tc_idx] != NULL) 
-    {
-	    result = tag_new_usable (tcache_get (tc_idx));
-      if (result != NULL) {
-        __mp_on_alloc(bytes, result);
-      return result;
-      }
-    }
+	  if (tcache->entries[tc_idx] != NULL)
+	    return mprof_on_alloc (prof, bytes,
+				   tag_new_usable (tcache_get (tc_idx)));
 	}
       else
         {
 	  tc_idx = large_csize2tidx (nb);
 	  void *victim = tcache_get_large (tc_idx, nb);
-	  if (victim != NULL) {
-      result = tag_new_usable (victim);
-      if (result != NULL) {
-      __mp_on_alloc(bytes, result);
-      return result;
-      } 
-
-    }
+	  if (victim != NULL)
+	    return mprof_on_alloc (prof, bytes, tag_new_usable (victim));
 	}
     }
 #endif
-  
-  result = __libc_malloc2 (bytes);
-  if (result != NULL) __mp_on_alloc(bytes, result);
-  return result;
+
+  return mprof_on_alloc2 (prof, bytes, __libc_malloc2 (bytes),
+			  mprof_is_large (bytes));
+}
+
+void *
+__libc_malloc (size_t bytes)
+{
+  return __libc_malloc_impl (bytes, true);
 }
 libc_hidden_def (__libc_malloc)
 
+#if MPROF_IFUNC
+static void *
+__libc_malloc_noprof (size_t bytes)
+{
+  return __libc_malloc_impl (bytes, false);
+}
+#endif
+
 static void __attribute_noinline__
 tcache_free_init (void *mem)
 {
@@ -3534,14 +3934,16 @@ tcache_free_init (void *mem)
   __libc_free (mem);
 }
 
-void
-__libc_free (void *mem)
+static __always_inline void
+__libc_free_impl (void *mem, bool prof)
 {
   mchunkptr p;                          /* chunk corresponding to mem */
 
   if (mem == NULL)                              /* free(0) has no effect */
     return;
 
+  mprof_on_free (prof, mem);
+
   /* Quickly check that the freed pointer matches the tag for the memory.
      This gives a useful double-free detection.  */
   if (__glibc_unlikely (mtag_enabled))
@@ -3593,19 +3995,36 @@ __libc_free (void *mem)
 
   _int_free_chunk (arena_for_chunk (p), p, size, 0);
 }
+
+void
+__libc_free (void *mem)
+{
+  __libc_free_impl (mem, true);
+}
 libc_hidden_def (__libc_free)
 
-void *
-__libc_realloc (void *oldmem, size_t bytes)
+#if MPROF_IFUNC
+static void
+__libc_free_noprof (void *mem)
+{
+  __libc_free_impl (mem, false);
+}
+#endif
+
+static __always_inline void *
+__libc_realloc_impl (void *oldmem, size_t bytes, struct mprof_realloc *r)
 {
   mstate ar_ptr;
   INTERNAL_SIZE_T nb;         /* padded request size */
 
   void *newp;             /* chunk to return */
 
+  r->old_size = 0;
+  mprof_realloc_note (r, mprof_realloc_new, 0);
+
   /* realloc of null is supposed to be same as malloc */
   if (oldmem == NULL)
-    return __libc_malloc (bytes);
+    return mprof_inner_malloc (bytes);
 
 #if REALLOC_ZERO_BYTES_FREES
   if (bytes == 0)
@@ -3628,6 +4047,8 @@ __libc_realloc (void *oldmem, size_t bytes)
      This is also why the heuristic misses alignment padding for THP for
      now.  */
   size_t usable = musable (oldmem);
+  r->old_size = usable;
+  mprof_realloc_note (r, mprof_realloc_in_place, 0);
   if (bytes <= usable)
     {
       size_t difference = usable - bytes;
@@ -3667,6 +4088,7 @@ __libc_realloc (void *oldmem, size_t bytes)
 	     reused.  There's a performance hit for both us and the
 	     caller for doing this, so we might want to
 	     reconsider.  */
+	  mprof_realloc_note (r, mprof_realloc_mremap, 0);
 	  return tag_new_usable (newmem);
 	}
 #endif
@@ -3675,10 +4097,11 @@ __libc_realloc (void *oldmem, size_t bytes)
 	return oldmem;
 
       /* Must alloc, copy, free. */
-      newmem = __libc_malloc (bytes);
+      newmem = mprof_inner_malloc (bytes);
       if (newmem == NULL)
         return NULL;              /* propagate failure */
 
+      mprof_realloc_note (r, mprof_realloc_copy, oldsize - CHUNK_HDR_SZ);
       memcpy (newmem, oldmem, oldsize - CHUNK_HDR_SZ);
       munmap_chunk (oldp);
       return newmem;
@@ -3692,6 +4115,10 @@ __libc_realloc (void *oldmem, size_t bytes)
       assert (!newp || chunk_is_mmapped (mem2chunk (newp)) ||
 	      ar_ptr == arena_for_chunk (mem2chunk (newp)));
 
+      /* _int_realloc copies memsize (oldp), the usable size, when it
+	 cannot resize in place.  */
+      if (newp != oldmem)
+	mprof_realloc_note (r, mprof_realloc_copy, usable);
       return newp;
     }
 
@@ -3703,11 +4130,14 @@ __libc_realloc (void *oldmem, size_t bytes)
   assert (!newp || chunk_is_mmapped (mem2chunk (newp)) ||
           ar_ptr == arena_for_chunk (mem2chunk (newp)));
 
+  if (newp != oldmem)
+    mprof_realloc_note (r, mprof_realloc_copy, usable);
+
   if (newp == NULL)
     {
       /* Try harder to allocate memory in other arenas.  */
       LIBC_PROBE (memory_realloc_retry, 2, bytes, oldmem);
-      newp = __libc_malloc (bytes);
+      newp = mprof_inner_malloc (bytes);
       if (newp != NULL)
         {
 	  size_t sz = memsize (oldp);
@@ -3719,12 +4149,30 @@ __libc_realloc (void *oldmem, size_t bytes)
 
   return newp;
 }
+
+void *
+__libc_realloc (void *oldmem, size_t bytes)
+{
+  struct mprof_realloc r;
+  void *newmem = __libc_realloc_impl (oldmem, bytes, &r);
+  return mprof_on_realloc (true, oldmem, bytes, newmem, &r);
+}
 libc_hidden_def (__libc_realloc)
 
+#if MPROF_IFUNC
+static void *
+__libc_realloc_noprof (void *oldmem, size_t bytes)
+{
+  struct mprof_realloc r;
+  return __libc_realloc_impl (oldmem, bytes, &r);
+}
+#endif
+
 void *
 __libc_memalign (size_t alignment, size_t bytes)
 {
-  return _mid_memalign (alignment, bytes);
+  return mprof_on_alloc2 (true, bytes, _mid_memalign (alignment, bytes),
+			  mprof_is_large (bytes));
 }
 libc_hidden_def (__libc_memalign)
 
@@ -3743,7 +4191,8 @@ aligned_alloc (size_t alignment, size_t bytes)
       return NULL;
     }
 
-  return _mid_memalign (alignment, bytes);
+  return mprof_on_alloc2 (true, bytes, _mid_memalign (alignment, bytes),
+			  mprof_is_large (bytes));
 }
 
 static void *
@@ -3752,9 +4201,10 @@ _mid_memalign (size_t alignment, size_t bytes)
   mstate ar_ptr;
   void *p;
 
-  /* If we need less alignment than we give anyway, just relay to malloc.  */
+  /* If we need less alignment than we give anyway, just relay to malloc.
+     Our callers report the request with their caller's address.  */
   if (alignment <= MALLOC_ALIGNMENT)
-    return __libc_malloc (bytes);
+    return mprof_inner_malloc (bytes);
 
   /* Otherwise, ensure that it is at least a minimum chunk size */
   if (alignment < MINSIZE)
@@ -3813,7 +4263,9 @@ _mid_memalign (size_t alignment, size_t bytes)
 void *
 __libc_valloc (size_t bytes)
 {
-  return _mid_memalign (GLRO (dl_pagesize), bytes);
+  return mprof_on_alloc2 (true, bytes,
+			  _mid_memalign (GLRO (dl_pagesize), bytes),
+			  mprof_is_large (bytes));
 }
 
 void *
@@ -3830,11 +4282,14 @@ __libc_pvalloc (size_t bytes)
       return NULL;
     }
 
-  return _mid_memalign (pagesize, rounded_bytes & -pagesize);
+  return mprof_on_alloc2 (true, bytes,
+			  _mid_memalign (pagesize, rounded_bytes & -pagesize),
+			  mprof_is_large (bytes));
 }
 
+/* Stores the number of bytes it zeroed in *CLEARED.  */
 static void * __attribute_noinline__
-__libc_calloc2 (size_t sz)
+__libc_calloc2 (size_t sz, size_t *cleared)
 {
   mstate av;
   mchunkptr oldtop, p;
@@ -3902,7 +4357,10 @@ __libc_calloc2 (size_t sz)
      regardless of MORECORE_CLEARS, so we zero the whole block while
      doing so.  */
   if (__glibc_unlikely (mtag_enabled))
-    return tag_new_zero_region (mem, memsize (p));
+    {
+      *cleared = memsize (p);
+      return tag_new_zero_region (mem, memsize (p));
+    }
 
   csz = chunksize (p);
 
@@ -3910,8 +4368,12 @@ __libc_calloc2 (size_t sz)
   if (chunk_is_mmapped (p))
     {
       if (__glibc_unlikely (perturb_byte))
-        return memset (mem, 0, sz);
+	{
+	  *cleared = sz;
+	  return memset (mem, 0, sz);
+	}
 
+      *cleared = 0;
       return mem;
     }
 
@@ -3924,13 +4386,15 @@ __libc_calloc2 (size_t sz)
 #endif
 
   clearsize = csz - SIZE_SZ;
+  *cleared = clearsize;
   return clear_memory ((INTERNAL_SIZE_T *) mem, clearsize);
 }
 
-void *
-__libc_calloc (size_t n, size_t elem_size)
+static __always_inline void *
+__libc_calloc_impl (size_t n, size_t elem_size, bool prof)
 {
   size_t bytes;
+  size_t cleared;
 
   if (__glibc_unlikely (__builtin_mul_overflow (n, elem_size, &bytes)))
     {
@@ -3951,9 +4415,16 @@ __libc_calloc (size_t n, size_t elem_size)
 	    {
 	      void *mem = tcache_get (tc_idx);
 	      if (__glibc_unlikely (mtag_enabled))
-		return tag_new_zero_region (mem, memsize (mem2chunk (mem)));
-
-	      return clear_memory ((INTERNAL_SIZE_T *) mem, tidx2usize (tc_idx));
+		{
+		  cleared = memsize (mem2chunk (mem));
+		  mem = tag_new_zero_region (mem, cleared);
+		}
+	      else
+		{
+		  cleared = tidx2usize (tc_idx);
+		  mem = clear_memory ((INTERNAL_SIZE_T *) mem, cleared);
+		}
+	      return mprof_on_calloc (prof, bytes, mem, cleared);
 	    }
 	}
       else
@@ -3962,16 +4433,33 @@ __libc_calloc (size_t n, size_t elem_size)
 	  void *mem = tcache_get_large (tc_idx, nb);
 	  if (mem != NULL)
 	    {
+	      cleared = memsize (mem2chunk (mem));
 	      if (__glibc_unlikely (mtag_enabled))
-	        return tag_new_zero_region (mem, memsize (mem2chunk (mem)));
-
-	      return memset (mem, 0, memsize (mem2chunk (mem)));
+	        mem = tag_new_zero_region (mem, cleared);
+	      else
+		mem = memset (mem, 0, cleared);
+	      return mprof_on_calloc (prof, bytes, mem, cleared);
 	    }
 	}
     }
 #endif
-  return __libc_calloc2 (bytes);
+  void *mem = __libc_calloc2 (bytes, &cleared);
+  return mprof_on_calloc2 (prof, bytes, mem, cleared, mprof_is_large (bytes));
+}
+
+void *
+__libc_calloc (size_t n, size_t elem_size)
+{
+  return __libc_calloc_impl (n, elem_size, true);
+}
+
+#if MPROF_IFUNC
+static void *
+__libc_calloc_noprof (size_t n, size_t elem_size)
+{
+  return __libc_calloc_impl (n, elem_size, false);
 }
+#endif
 #endif /* IS_IN (libc) */
 
 /*
@@ -4097,10 +4585,12 @@ _int_malloc (mstate av, size_t bytes)
 			  if (__glibc_unlikely (tc_victim == NULL))
 			    break;
 			}
+		      arena_count_reuse (av);
 		      tcache_put (tc_victim, tc_idx);
 		    }
 		}
 #endif
+	      arena_count_reuse (av);
 	      void *p = chunk2mem (victim);
 	      alloc_perturb (p, bytes);
 	      return p;
@@ -4157,11 +4647,13 @@ _int_malloc (mstate av, size_t bytes)
 		      bin->bk = bck;
 		      bck->fd = bin;
 
+		      arena_count_alloc (av, chunksize (tc_victim));
 		      tcache_put (tc_victim, tc_idx);
 	            }
 		}
 	    }
 #endif
+          arena_count_alloc (av, chunksize (victim));
           void *p = chunk2mem (victim);
           alloc_perturb (p, bytes);
           return p;
@@ -4263,6 +4755,7 @@ _int_malloc (mstate av, size_t bytes)
               set_foot (remainder, remainder_size);
 
               check_malloced_chunk (av, victim, nb);
+              arena_count_alloc (av, chunksize (victim));
               void *p = chunk2mem (victim);
               alloc_perturb (p, bytes);
               return p;
@@ -4287,6 +4780,7 @@ _int_malloc (mstate av, size_t bytes)
 	      if (tcache_nb > 0
 		  && tcache->num_slots[tc_idx] != 0)
 		{
+		  arena_count_alloc (av, chunksize (victim));
 		  tcache_put (victim, tc_idx);
 		  return_cached = 1;
 		  continue;
@@ -4295,6 +4789,7 @@ _int_malloc (mstate av, size_t bytes)
 		{
 #endif
               check_malloced_chunk (av, victim, nb);
+              arena_count_alloc (av, chunksize (victim));
               void *p = chunk2mem (victim);
               alloc_perturb (p, bytes);
               return p;
@@ -4460,6 +4955,7 @@ _int_malloc (mstate av, size_t bytes)
                   set_foot (remainder, remainder_size);
                 }
               check_malloced_chunk (av, victim, nb);
+              arena_count_alloc (av, chunksize (victim));
               void *p = chunk2mem (victim);
               alloc_perturb (p, bytes);
               return p;
@@ -4568,6 +5064,7 @@ _int_malloc (mstate av, size_t bytes)
                   set_foot (remainder, remainder_size);
                 }
               check_malloced_chunk (av, victim, nb);
+              arena_count_alloc (av, chunksize (victim));
               void *p = chunk2mem (victim);
               alloc_perturb (p, bytes);
               return p;
@@ -4606,6 +5103,7 @@ _int_malloc (mstate av, size_t bytes)
           set_head (remainder, remainder_size | PREV_INUSE);
 
           check_malloced_chunk (av, victim, nb);
+          arena_count_alloc (av, chunksize (victim));
           void *p = chunk2mem (victim);
           alloc_perturb (p, bytes);
           return p;
@@ -4630,7 +5128,11 @@ _int_malloc (mstate av, size_t bytes)
         {
           void *p = sysmalloc (nb, av);
           if (p != NULL)
-            alloc_perturb (p, bytes);
+            {
+              if (!chunk_is_mmapped (mem2chunk (p)))
+                arena_count_alloc (av, chunksize (mem2chunk (p)));
+              alloc_perturb (p, bytes);
+            }
           return p;
         }
     }
@@ -4740,6 +5242,7 @@ _int_free_chunk (mstate av, mchunkptr p, INTERNAL_SIZE_T size, int have_lock)
     if (!have_lock)
       __libc_lock_lock (av->mutex);
 
+    arena_count_free (av);
     _int_free_merge_chunk (av, p, size);
 
     if (!have_lock)
@@ -4803,6 +5306,7 @@ _int_free_merge_chunk (mstate av, mchunkptr p, INTERNAL_SIZE_T size)
     malloc_printerr ("free(): invalid next size (normal)");
 
   free_perturb (chunk2mem(p), size - CHUNK_HDR_SZ);
+  arena_count_release (av, size);
 
   /* Consolidate backward.  */
   if (!prev_inuse(p))
@@ -4990,6 +5494,8 @@ static void malloc_consolidate(mstate av)
 
 	/* Slightly streamlined version of consolidation code in free() */
 	size = chunksize (p);
+	arena_count_free (av);
+	arena_count_release (av, size);
 	nextchunk = chunk_at_offset(p, size);
 	nextsize = chunksize(nextchunk);
 
@@ -5089,6 +5595,7 @@ _int_realloc (mstate av, mchunkptr oldp, INTERNAL_SIZE_T oldsize,
           set_head_size (oldp, nb | (av != &main_arena ? NON_MAIN_ARENA : 0));
           av->top = chunk_at_offset (oldp, nb);
           set_head (av->top, (newsize - nb) | PREV_INUSE);
+          arena_count_grow (av, nb - oldsize);
           check_inuse_chunk (av, oldp);
           return tag_new_usable (chunk2mem (oldp));
         }
@@ -5101,6 +5608,7 @@ _int_realloc (mstate av, mchunkptr oldp, INTERNAL_SIZE_T oldsize,
         {
           newp = oldp;
           unlink_chunk (av, next);
+          arena_count_grow (av, nextsize);
         }
 
       /* allocate, copy, free */
@@ -5120,6 +5628,8 @@ _int_realloc (mstate av, mchunkptr oldp, INTERNAL_SIZE_T oldsize,
             {
               newsize += oldsize;
               newp = oldp;
+	      /* The chunk _int_malloc counted is now part of OLDP.  */
+	      arena_count_free (av);
             }
           else
             {
@@ -5156,6 +5666,9 @@ _int_realloc (mstate av, mchunkptr oldp, INTERNAL_SIZE_T oldsize,
                 (av != &main_arena ? NON_MAIN_ARENA : 0));
       /* Mark remainder as inuse so free() won't complain */
       set_inuse_bit_at_offset (remainder, remainder_size);
+      /* Its bytes count as in use already; count it as a chunk too, so
+	 that freeing it leaves allocs - frees unchanged.  */
+      arena_count_alloc (av, 0);
       _int_free_chunk (av, remainder, chunksize (remainder), 1);
     }
 
@@ -5222,6 +5735,7 @@ _int_memalign (mstate av, size_t alignment, size_t bytes)
       mchunkptr nextchunk = chunk_at_offset (p, size);
       mchunkptr remainder = chunk_at_offset (p, nb);
       set_head_size (p, nb);
+      arena_count_release (av, size - nb);
       size = _int_free_create_chunk (av, remainder, size - nb, nextchunk,
 				     chunksize (nextchunk));
       _int_free_maybe_consolidate (av, size);
@@ -5431,6 +5945,54 @@ __libc_mallinfo2 (void)
 }
 libc_hidden_def (__libc_mallinfo2)
 
+/* Like mallinfo2, but from the arena counters, without the locks.
+   Builds without the counters report only the system and mmapped
+   totals.  */
+size_t
+__malloc_arena_stats (struct malloc_arena_stats *stats, size_t n)
+{
+  struct malloc_arena_stats total;
+  size_t k = 1;
+
+  memset (&total, 0, sizeof (total));
+  total.mmapped = atomic_load_relaxed (&mp_.mmapped_mem);
+  total.nmmaps = atomic_load_relaxed (&mp_.n_mmaps);
+
+  mstate ar_ptr = &main_arena;
+  do
+    {
+      struct malloc_arena_stats m;
+      memset (&m, 0, sizeof (m));
+
+      m.system = atomic_load_relaxed (&ar_ptr->system_mem);
+#if MALLOC_ARENA_COUNTERS
+      /* system_mem is read apart from the counters, so it can lag
+	 behind them while other threads allocate.  */
+      m.in_use = MIN (atomic_load_relaxed (&ar_ptr->counters.in_use),
+		      m.system);
+      m.unused = m.system - m.in_use;
+      m.allocs = atomic_load_relaxed (&ar_ptr->counters.allocs);
+      m.frees = atomic_load_relaxed (&ar_ptr->counters.frees);
+#endif
+
+      total.system += m.system;
+      total.in_use += m.in_use;
+      total.unused += m.unused;
+      total.allocs += m.allocs;
+      total.frees += m.frees;
+      if (k < n)
+	stats[k] = m;
+      ++k;
+
+      ar_ptr = atomic_load_relaxed (&ar_ptr->next);
+    }
+  while (ar_ptr != &main_arena);
+
+  if (n > 0)
+    stats[0] = total;
+  return k;
+}
+
 struct mallinfo
 __libc_mallinfo (void)
 {
@@ -5895,7 +6457,8 @@ __posix_memalign (void **memptr, size_t alignment, size_t size)
     return EINVAL;
 
 
-  mem = _mid_memalign (alignment, size);
+  mem = mprof_on_alloc2 (true, size, _mid_memalign (alignment, size),
+			 mprof_is_large (size));
 
   if (mem != NULL)
     {
@@ -5909,12 +6472,133 @@ weak_alias (__posix_memalign, posix_memalign)
 #endif
 
 
+#if defined USE_MALLOC_PROF && IS_IN (libc)
+/* Describe the non-empty bins of TC, a registered tcache of a thread
+   that may be running, in up to N records at OUT.  Only the counters
+   are read, never the lists.  A large bin holds chunks of several
+   sizes; its bytes are counted at the smallest.  */
+size_t
+__malloc_tcache_bins (const void *tc, struct mp_free_bin *out, size_t n)
+{
+  size_t k = 0;
+#if USE_TCACHE
+  const tcache_perthread_struct *t = tc;
+  size_t count = mp_.tcache_count;
+
+  for (size_t i = 0; i < TCACHE_MAX_BINS && k < n; ++i)
+    {
+      size_t slots = atomic_load_relaxed (&t->num_slots[i]);
+      if (slots >= count)
+	continue;
+
+      size_t csize;
+      if (i < TCACHE_SMALL_BINS)
+	csize = tidx2csize (i);
+      else
+	csize = MAX ((size_t) 1 << (31 - __builtin_clz (MAX_TCACHE_SMALL_SIZE)
+				    + i - TCACHE_SMALL_BINS),
+		     MAX_TCACHE_SMALL_SIZE + MALLOC_ALIGNMENT);
+
+      out[k].owner = 0;
+      out[k].kind = MP_FREE_TCACHE;
+      out[k].bin = i;
+      out[k].count = count - slots;
+      out[k].chunk_size = csize;
+      out[k].bytes = (count - slots) * csize;
+      ++k;
+    }
+#endif
+  return k;
+}
+
+static size_t
+mprof_free_bin (struct mp_free_bin *out, uint32_t owner, uint32_t kind,
+		uint32_t bin, uint32_t count, size_t chunk_size, size_t bytes)
+{
+  if (count == 0)
+    return 0;
+  out->owner = owner;
+  out->kind = kind;
+  out->bin = bin;
+  out->count = count;
+  out->chunk_size = chunk_size;
+  out->bytes = bytes;
+  return 1;
+}
+
+/* Describe the free chunks of every arena in up to N records at OUT:
+   its top chunk and each non-empty fastbin and bin, with the smallest
+   chunk size in the bin.  Like malloc_info, this locks one arena at a
+   time, so threads using other arenas carry on.  */
+size_t
+__malloc_arena_bins (struct mp_free_bin *out, size_t n)
+{
+  size_t k = 0;
+  uint32_t nr = 0;
+  mstate ar_ptr = &main_arena;
+  do
+    {
+      if (n - k < 1 + NFASTBINS + NBINS)
+	break;
+
+      __libc_lock_lock (ar_ptr->mutex);
+
+      k += mprof_free_bin (out + k, nr, MP_FREE_TOP, 0, 1,
+			   chunksize (ar_ptr->top), chunksize (ar_ptr->top));
+
+      for (size_t i = 0; i < NFASTBINS; ++i)
+	{
+	  size_t count = 0;
+	  size_t csize = 0;
+	  for (mchunkptr p = fastbin (ar_ptr, i); p != NULL;
+	       p = REVEAL_PTR (p->fd))
+	    {
+	      if (__glibc_unlikely (misaligned_chunk (p)))
+		malloc_printerr ("__malloc_arena_bins(): "
+				 "unaligned fastbin chunk detected");
+	      csize = chunksize (p);
+	      ++count;
+	    }
+	  k += mprof_free_bin (out + k, nr, MP_FREE_FAST, i, count, csize,
+			       count * csize);
+	}
+
+      for (size_t i = 1; i < NBINS; ++i)
+	{
+	  mbinptr bin = bin_at (ar_ptr, i);
+	  size_t count = 0;
+	  size_t bytes = 0;
+	  size_t csize = ~((size_t) 0);
+	  for (mchunkptr r = bin->fd; r != NULL && r != bin; r = r->fd)
+	    {
+	      size_t r_size = chunksize_nomask (r);
+	      csize = MIN (csize, r_size);
+	      bytes += r_size;
+	      ++count;
+	    }
+	  uint32_t kind = (i == 1 ? MP_FREE_UNSORTED
+			   : i < NSMALLBINS ? MP_FREE_SMALL : MP_FREE_LARGE);
+	  k += mprof_free_bin (out + k, nr, kind, i, count, csize, bytes);
+	}
+
+      __libc_lock_unlock (ar_ptr->mutex);
+
+      ++nr;
+      ar_ptr = ar_ptr->next;
+    }
+  while (ar_ptr != &main_arena);
+
+  return k;
+}
+#endif
+
+
 int
 __malloc_info (int options, FILE *fp)
 {
-  /* For now, at least.  */
-  if (options != 0)
+  if ((options & ~MALLOC_INFO_JSON) != 0)
     return EINVAL;
+  bool json = options & MALLOC_INFO_JSON;
 
   int n = 0;
   size_t total_nblocks = 0;
@@ -5926,13 +6610,18 @@ __malloc_info (int options, FILE *fp)
   size_t total_aspace = 0;
   size_t total_aspace_mprotect = 0;
 
-  fputs ("<malloc version=\"1\">\n", fp);
+  fputs (json ? "{\"version\":1,\"heaps\":[" : "<malloc version=\"1\">\n",
+	 fp);
 
   /* Iterate over all arenas currently in use.  */
   mstate ar_ptr = &main_arena;
   do
     {
-      fprintf (fp, "<heap nr=\"%d\">\n<sizes>\n", n++);
+      if (json)
+	fprintf (fp, "%s{\"nr\":%d,\"sizes\":[", n > 0 ? "," : "", n);
+      else
+	fprintf (fp, "<heap nr=\"%d\">\n<sizes>\n", n);
+      ++n;
 
       size_t nblocks = 0;
       size_t nfastblocks = 0;
@@ -6041,79 +6730,119 @@ __malloc_info (int options, FILE *fp)
       total_nblocks += nblocks;
       total_avail += avail;
 
+      const char *sep = "";
       for (size_t i = 0; i < nsizes; ++i)
 	if (sizes[i].count != 0 && i != NFASTBINS)
-	  fprintf (fp, "\
+	  {
+	    if (json)
+	      fprintf (fp, "%s{\"from\":%zu,\"to\":%zu,\"total\":%zu,"
+		       "\"count\":%zu}", sep,
+		       sizes[i].from, sizes[i].to, sizes[i].total,
+		       sizes[i].count);
+	    else
+	      fprintf (fp, "\
   <size from=\"%zu\" to=\"%zu\" total=\"%zu\" count=\"%zu\"/>\n",
-		   sizes[i].from, sizes[i].to, sizes[i].total, sizes[i].count);
+		       sizes[i].from, sizes[i].to, sizes[i].total,
+		       sizes[i].count);
+	    sep = ",";
+	  }
+      if (json)
+	fputs ("]", fp);
 
       if (sizes[NFASTBINS].count != 0)
-	fprintf (fp, "\
-  <unsorted from=\"%zu\" to=\"%zu\" total=\"%zu\" count=\"%zu\"/>\n",
+	fprintf (fp, json
+		 ? ",\"unsorted\":{\"from\":%zu,\"to\":%zu,\"total\":%zu,"
+		   "\"count\":%zu}"
+		 : "  <unsorted from=\"%zu\" to=\"%zu\" total=\"%zu\" "
+		   "count=\"%zu\"/>\n",
 		 sizes[NFASTBINS].from, sizes[NFASTBINS].to,
 		 sizes[NFASTBINS].total, sizes[NFASTBINS].count);
 
       total_system += ar_ptr->system_mem;
       total_max_system += ar_ptr->max_system_mem;
 
-      fprintf (fp,
-	       "</sizes>\n<total type=\"fast\" count=\"%zu\" size=\"%zu\"/>\n"
-	       "<total type=\"rest\" count=\"%zu\" size=\"%zu\"/>\n"
-	       "<system type=\"current\" size=\"%zu\"/>\n"
-	       "<system type=\"max\" size=\"%zu\"/>\n",
+      fprintf (fp, json
+	       ? ",\"fast\":{\"count\":%zu,\"size\":%zu},"
+		 "\"rest\":{\"count\":%zu,\"size\":%zu},"
+		 "\"system\":{\"current\":%zu,\"max\":%zu}"
+	       : "</sizes>\n<total type=\"fast\" count=\"%zu\" size=\"%zu\"/>\n"
+		 "<total type=\"rest\" count=\"%zu\" size=\"%zu\"/>\n"
+		 "<system type=\"current\" size=\"%zu\"/>\n"
+		 "<system type=\"max\" size=\"%zu\"/>\n",
 	       nfastblocks, fastavail, nblocks, avail,
 	       ar_ptr->system_mem, ar_ptr->max_system_mem);
 
       if (ar_ptr != &main_arena)
 	{
-	  fprintf (fp,
-		   "<aspace type=\"total\" size=\"%zu\"/>\n"
-		   "<aspace type=\"mprotect\" size=\"%zu\"/>\n"
-		   "<aspace type=\"subheaps\" size=\"%zu\"/>\n",
+	  fprintf (fp, json
+		   ? ",\"aspace\":{\"total\":%zu,\"mprotect\":%zu,"
+		     "\"subheaps\":%zu}"
+		   : "<aspace type=\"total\" size=\"%zu\"/>\n"
+		     "<aspace type=\"mprotect\" size=\"%zu\"/>\n"
+		     "<aspace type=\"subheaps\" size=\"%zu\"/>\n",
 		   heap_size, heap_mprotect_size, heap_count);
 	  total_aspace += heap_size;
 	  total_aspace_mprotect += heap_mprotect_size;
 	}
       else
 	{
-	  fprintf (fp,
-		   "<aspace type=\"total\" size=\"%zu\"/>\n"
-		   "<aspace type=\"mprotect\" size=\"%zu\"/>\n",
+	  fprintf (fp, json
+		   ? ",\"aspace\":{\"total\":%zu,\"mprotect\":%zu}"
+		   : "<aspace type=\"total\" size=\"%zu\"/>\n"
+		     "<aspace type=\"mprotect\" size=\"%zu\"/>\n",
 		   ar_ptr->system_mem, ar_ptr->system_mem);
 	  total_aspace += ar_ptr->system_mem;
 	  total_aspace_mprotect += ar_ptr->system_mem;
 	}
 
-      fputs ("</heap>\n", fp);
+      fputs (json ? "}" : "</heap>\n", fp);
       ar_ptr = ar_ptr->next;
     }
   while (ar_ptr != &main_arena);
 
-  fprintf (fp,
-	   "<total type=\"fast\" count=\"%zu\" size=\"%zu\"/>\n"
-	   "<total type=\"rest\" count=\"%zu\" size=\"%zu\"/>\n"
-	   "<total type=\"mmap\" count=\"%d\" size=\"%zu\"/>\n"
-	   "<system type=\"current\" size=\"%zu\"/>\n"
-	   "<system type=\"max\" size=\"%zu\"/>\n"
-	   "<aspace type=\"total\" size=\"%zu\"/>\n"
-	   "<aspace type=\"mprotect\" size=\"%zu\"/>\n"
-	   "</malloc>\n",
+  fprintf (fp, json
+	   ? "],\"fast\":{\"count\":%zu,\"size\":%zu},"
+	     "\"rest\":{\"count\":%zu,\"size\":%zu},"
+	     "\"mmap\":{\"count\":%d,\"size\":%zu},"
+	     "\"system\":{\"current\":%zu,\"max\":%zu},"
+	     "\"aspace\":{\"total\":%zu,\"mprotect\":%zu}"
+	   : "<total type=\"fast\" count=\"%zu\" size=\"%zu\"/>\n"
+	     "<total type=\"rest\" count=\"%zu\" size=\"%zu\"/>\n"
+	     "<total type=\"mmap\" count=\"%d\" size=\"%zu\"/>\n"
+	     "<system type=\"current\" size=\"%zu\"/>\n"
+	     "<system type=\"max\" size=\"%zu\"/>\n"
+	     "<aspace type=\"total\" size=\"%zu\"/>\n"
+	     "<aspace type=\"mprotect\" size=\"%zu\"/>\n",
 	   total_nfastblocks, total_fastavail, total_nblocks, total_avail,
 	   mp_.n_mmaps, mp_.mmapped_mem,
 	   total_system, total_max_system,
 	   total_aspace, total_aspace_mprotect);
 
+  mprof_info (fp, json);
+  fputs (json ? "}\n" : "</malloc>\n", fp);
+
   return 0;
 }
 #if IS_IN (libc)
 weak_alias (__malloc_info, malloc_info)
 
-strong_alias (__libc_calloc, __calloc) weak_alias (__libc_calloc, calloc)
-strong_alias (__libc_free, __free) strong_alias (__libc_free, free)
-strong_alias (__libc_malloc, __malloc) strong_alias (__libc_malloc, malloc)
+strong_alias (__libc_calloc, __calloc)
+strong_alias (__libc_free, __free)
+strong_alias (__libc_malloc, __malloc)
+strong_alias (__libc_realloc, __realloc)
+#if MPROF_IFUNC
+mprof_ifunc (calloc, __libc_calloc);
+mprof_ifunc (free, __libc_free);
+mprof_ifunc (malloc, __libc_malloc);
+mprof_ifunc (realloc, __libc_realloc);
+#else
+weak_alias (__libc_calloc, calloc)
+strong_alias (__libc_free, free)
+strong_alias (__libc_malloc, malloc)
+strong_alias (__libc_realloc, realloc)
+#endif
 strong_alias (__libc_memalign, __memalign)
 weak_alias (__libc_memalign, memalign)
-strong_alias (__libc_realloc, __realloc) strong_alias (__libc_realloc, realloc)
 strong_alias (__libc_valloc, __valloc) weak_alias (__libc_valloc, valloc)
 strong_alias (__libc_pvalloc, __pvalloc) weak_alias (__libc_pvalloc, pvalloc)
 strong_alias (__libc_mallinfo, __mallinfo)
@@ -6123,6 +6852,7 @@ weak_alias (__libc_mallinfo2, mallinfo2)
 strong_alias (__libc_mallopt, __mallopt) weak_alias (__libc_mallopt, mallopt)
 
 weak_alias (__malloc_stats, malloc_stats)
+weak_alias (__malloc_arena_stats, malloc_arena_stats)
 weak_alias (__malloc_usable_size, malloc_usable_size)
 weak_alias (__malloc_trim, malloc_trim)
 #endif
@@ -116,6 +116,32 @@ extern struct mallinfo mallinfo (void) __THROW __MALLOC_DEPRECATED;
 /* Returns a copy of the updated current mallinfo. */
 extern struct mallinfo2 mallinfo2 (void) __THROW;
 
+/* Approximate statistics of one arena, or of the whole process, read
+   without locking any arena.  */
+struct malloc_arena_stats
+{
+  size_t system;   /* non-mmapped space allocated from system */
+  size_t in_use;   /* estimated space in allocated chunks, thread caches
+		      and fastbins included */
+  size_t unused;   /* system - in_use: free chunks in bins and the top
+		      chunk */
+  size_t mmapped;  /* space in mmapped regions, process totals only */
+  size_t nmmaps;   /* number of mmapped regions, process totals only */
+  size_t allocs;   /* number of chunks handed out by the arena */
+  size_t frees;    /* number of chunks returned to the arena */
+};
+
+/* Store process totals in __STATS[0] and the statistics of each arena
+   in __STATS[1] onwards, up to __N entries in all, and return the
+   number of entries there would be with room for every arena.  Unlike
+   mallinfo2 this takes no lock, so threads using malloc are not held
+   up; the counters may be off by the operations in progress.  The
+   counters behind in_use, unused, allocs and frees are only kept when
+   glibc is configured with --enable-malloc-profiler; otherwise those
+   fields are 0.  */
+extern size_t malloc_arena_stats (struct malloc_arena_stats *__stats,
+				  size_t __n) __THROW;
+
 /* SVID2/XPG mallopt options */
 #ifndef M_MXFAST
 # define M_MXFAST  1    /* maximum request size for "fastbins" */
@@ -154,8 +180,41 @@ extern size_t malloc_usable_size (void *__ptr) __THROW;
 /* Prints brief summary statistics on stderr. */
 extern void malloc_stats (void) __THROW;
 
-/* Output information about state of allocator to stream FP.  */
+/* Output information about state of allocator to stream FP, as XML
+   unless __OPTIONS has MALLOC_INFO_JSON.  */
 extern int malloc_info (int __options, FILE *__fp) __THROW;
 
+/* malloc_info options.  */
+#define MALLOC_INFO_JSON 1	/* one line of compact JSON */
+
+/* Sampling profiler labels.  Samples taken while a label is current in
+   the calling thread are attributed to it as well as to their call
+   site.  Ids are small integers, 0 meaning no label; all of these
+   return 0 and do nothing useful if glibc was built without
+   --enable-malloc-profiler.  */
+
+/* Return the id for the pair __KEY, __VALUE, interning it if needed.
+   Returns 0 if the label table is full.  */
+extern unsigned int malloc_profile_label (const char *__key,
+					  const char *__value) __THROW;
+
+/* Make the pair __KEY, __VALUE the current label of the calling thread
+   and return the id of the previous one.  */
+extern unsigned int malloc_profile_set_label (const char *__key,
+					      const char *__value) __THROW;
+
+/* Make __ID the current label of the calling thread and return the
+   previous one, to be restored with malloc_profile_pop_label.  */
+extern unsigned int malloc_profile_push_label (unsigned int __id) __THROW;
+extern void malloc_profile_pop_label (unsigned int __prev) __THROW;
+
+/* Sample the calling thread's allocations at the finer
+   GLIBC_MALLOC_PROFILE_REGION_BYTES stride until
+   malloc_profile_region_end, into a profile of their own for the region
+   called __NAME that also has exact allocation counts and bytes.
+   Regions do not nest; beginning one ends the current one.  */
+extern void malloc_profile_region_begin (const char *__name) __THROW;
+extern void malloc_profile_region_end (void) __THROW;
+
 __END_DECLS
 #endif /* malloc.h */
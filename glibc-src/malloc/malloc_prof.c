@@ -1,10 +1,13 @@
-/*
-- have a look at using compiler flags for profiler off 
-*/
+/* Sampling allocation profiler.  Only built into glibc when it is
+   configured with --enable-malloc-profiler; see the mprof_* hooks in
+   malloc.c.  The same file is also built with MPROF_SHIM defined into
+   the LD_PRELOAD library in mprof-shim/, which calls the same entry
+   points from its malloc wrappers.  */
 
 #define _GNU_SOURCE
 #include <stddef.h>
 #include <stdint.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -12,9 +15,42 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <time.h>
+#include <malloc.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <sys/syscall.h>
 
 #include "malloc_prof.h"
 
+#ifdef MPROF_SHIM
+# define mp_usable_size(p) malloc_usable_size(p)
+#else
+/* Defined in malloc.c; malloc_usable_size is only a weak alias.  */
+size_t __malloc_usable_size(void *);
+# define mp_usable_size(p) __malloc_usable_size(p)
+# define TUNABLE_NAMESPACE malloc
+# include <elf/dl-tunables.h>
+#endif
+
+/* Whether the profiler was requested.  Inside libc this is the
+   glibc.malloc.profile tunable, the same value the IFUNC resolvers in
+   malloc.c select on, so GLIBC_MALLOC_PROFILE only reaches us through
+   the tunable's env_alias.  The shim has no tunables and reads the
+   variable directly.  */
+static int
+mp_profile_requested(void)
+{
+#ifdef MPROF_SHIM
+    const char *env = getenv("GLIBC_MALLOC_PROFILE");
+    return env && env[0] == '1';
+#else
+    return TUNABLE_GET (profile, int32_t, NULL) != 0;
+#endif
+}
+
 /* ------------------------------------------------------
  * Global profiler configuration
  * ----------------------------------------------------*/
@@ -23,10 +59,39 @@ static int mp_global_enabled = -1;                   /* -1 = uninitialized, 0=of
 static uint64_t mp_sample_stride_bytes = 512 * 1024; /* default 512KB */
 static int mp_stats_enabled = 0;                     /* dump human stats */
 static const char *mp_out_base = NULL;               /* binary dump path */
+static int mp_percpu_enabled = 0;                    /* aggregate per CPU */
+static uint64_t mp_max_sps = 0;                      /* sample budget, 0=fixed stride */
+static uint64_t mp_max_sps_per_cpu = 0;              /* share of one running thread */
+static uint64_t mp_region_stride_bytes = 4096;       /* stride inside regions */
+static int mp_region_only = 0;                       /* sample only in regions */
+static int mp_random = 0;                            /* exponential intervals */
+static int mp_seeded = 0;                            /* reproducible mode */
+static uint64_t mp_seed;
+static int mp_live_enabled = 0;                      /* track live samples */
+static uint64_t mp_peak_margin = 0;                  /* peak snapshots, 0=off */
+static uint64_t mp_peak_batch;                       /* per-thread flush size */
+static uint64_t mp_growth_pct = 0;                   /* growth snapshots, */
+static uint64_t mp_growth_bytes = 0;                 /*   0 = off */
+size_t __mp_large_bytes = SIZE_MAX;                  /* exact recording */
+static uint64_t mp_cold_min = 0;                     /* cold tracking, 0=off */
+static uint64_t mp_cold_age_ns = 60000000000ULL;     /* default 60 s */
+static uintptr_t mp_pagesize;                        /* set with live tracking */
+static uint64_t mp_fshare_max = 0;                   /* false sharing, 0=off */
+static int mp_numa_enabled = 0;                      /* NUMA node report */
+static int mp_tcache_enabled = 0;                    /* thread cache report */
+static uint64_t mp_info_sites = 10;                  /* top sites in malloc_info */
+
+#define MP_INFO_SITE_CAP 256     /* most sites malloc_info lists */
+#define MP_INFO_MERGE_CAP 1024   /* distinct sites it can merge */
 
 /* Per-thread TLS state */
 __thread struct __mp_tls __mp_tls_state;
 
+/* Thread registry: singly linked list of every record ever created,
+   newest first.  Records are only ever pushed, never unlinked.  */
+static struct mp_thread_rec *mp_registry_head;
+static uint64_t mp_registry_joins;
+
 
 /* ------------------------------------------------------
  * Initialization
@@ -38,8 +103,7 @@ mp_global_init_if_needed(void)
     if (mp_global_enabled != -1)
         return;
 
-    const char *env = getenv("GLIBC_MALLOC_PROFILE");
-    if (env && env[0] == '1') {
+    if (mp_profile_requested()) {
         mp_global_enabled = 1;
 
         const char *stride_env = getenv("GLIBC_MALLOC_PROFILE_BYTES");
@@ -58,16 +122,430 @@ mp_global_init_if_needed(void)
         if (out_env && out_env[0] != '\0')
             mp_out_base = out_env;
 
+        const char *percpu_env = getenv("GLIBC_MALLOC_PROFILE_PERCPU");
+        if (percpu_env && percpu_env[0] == '1')
+            mp_percpu_enabled = 1;
+
+        const char *sps_env = getenv("GLIBC_MALLOC_PROFILE_MAX_SPS");
+        if (sps_env) {
+            char *end = NULL;
+            unsigned long long v = strtoull(sps_env, &end, 10);
+            if (end && *end == '\0' && v > 0) {
+                /* At most one thread runs per CPU, so a per-thread rate
+                   measured against its own CPU time bounds the total.  */
+                long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+                mp_max_sps = v;
+                mp_max_sps_per_cpu = v / (uint64_t)(ncpu > 0 ? ncpu : 1);
+                if (mp_max_sps_per_cpu == 0)
+                    mp_max_sps_per_cpu = 1;
+            }
+        }
+
+        const char *region_env = getenv("GLIBC_MALLOC_PROFILE_REGION_BYTES");
+        if (region_env) {
+            char *end = NULL;
+            unsigned long long v = strtoull(region_env, &end, 10);
+            if (end && *end == '\0' && v > 0)
+                mp_region_stride_bytes = v;
+        }
+
+        const char *ronly_env = getenv("GLIBC_MALLOC_PROFILE_REGION_ONLY");
+        if (ronly_env && ronly_env[0] == '1')
+            mp_region_only = 1;
+
+        const char *random_env = getenv("GLIBC_MALLOC_PROFILE_RANDOM");
+        if (random_env && random_env[0] == '1')
+            mp_random = 1;
+
+        const char *seed_env = getenv("GLIBC_MALLOC_PROFILE_SEED");
+        if (seed_env) {
+            char *end = NULL;
+            unsigned long long v = strtoull(seed_env, &end, 0);
+            if (end && end != seed_env && *end == '\0') {
+                mp_seed = v;
+                mp_seeded = 1;
+                mp_random = 1;
+            }
+        }
+
+        const char *live_env = getenv("GLIBC_MALLOC_PROFILE_LIVE");
+        if (live_env && live_env[0] == '1')
+            mp_live_enabled = 1;
+
+        const char *peak_env = getenv("GLIBC_MALLOC_PROFILE_PEAK");
+        if (peak_env) {
+            char *end = NULL;
+            unsigned long long v = strtoull(peak_env, &end, 10);
+            if (end && *end == '\0' && v > 0) {
+                mp_peak_margin = v;
+                mp_peak_batch = v / 16;
+                mp_live_enabled = 1;
+            }
+        }
+
+        const char *gpct_env = getenv("GLIBC_MALLOC_PROFILE_GROWTH_PCT");
+        if (gpct_env) {
+            char *end = NULL;
+            unsigned long long v = strtoull(gpct_env, &end, 10);
+            if (end && *end == '\0' && v > 0)
+                mp_growth_pct = v;
+        }
+
+        const char *gmb_env = getenv("GLIBC_MALLOC_PROFILE_GROWTH_MB");
+        if (gmb_env) {
+            char *end = NULL;
+            unsigned long long v = strtoull(gmb_env, &end, 10);
+            if (end && *end == '\0' && v > 0 && v < (1ULL << 44))
+                mp_growth_bytes = v << 20;
+        }
+
+        const char *large_env = getenv("GLIBC_MALLOC_PROFILE_LARGE");
+        if (large_env && strcmp(large_env, "mmap") == 0) {
+            __mp_large_bytes = 0;
+        } else if (large_env) {
+            char *end = NULL;
+            unsigned long long v = strtoull(large_env, &end, 10);
+            if (end && *end == '\0' && v > 0)
+                __mp_large_bytes = v;
+        }
+
+        const char *cold_env = getenv("GLIBC_MALLOC_PROFILE_COLD");
+        if (cold_env) {
+            char *end = NULL;
+            unsigned long long v = strtoull(cold_env, &end, 10);
+            if (end && *end == '\0' && v > 0) {
+                mp_cold_min = v;
+                mp_live_enabled = 1;
+            }
+        }
+
+        const char *cage_env = getenv("GLIBC_MALLOC_PROFILE_COLD_AGE");
+        if (cage_env) {
+            char *end = NULL;
+            unsigned long long v = strtoull(cage_env, &end, 10);
+            if (end && *end == '\0' && v > 0 && v < (1ULL << 32))
+                mp_cold_age_ns = v * 1000000000ULL;
+        }
+
+        const char *fshare_env = getenv("GLIBC_MALLOC_PROFILE_FALSE_SHARING");
+        if (fshare_env) {
+            char *end = NULL;
+            unsigned long long v = strtoull(fshare_env, &end, 10);
+            if (end && *end == '\0' && v > 0) {
+                mp_fshare_max = v;
+                mp_live_enabled = 1;
+            }
+        }
+
+        const char *numa_env = getenv("GLIBC_MALLOC_PROFILE_NUMA");
+        if (numa_env && numa_env[0] == '1') {
+            mp_numa_enabled = 1;
+            mp_live_enabled = 1;
+        }
+
+        const char *tcache_env = getenv("GLIBC_MALLOC_PROFILE_TCACHE");
+        if (tcache_env && tcache_env[0] == '1')
+            mp_tcache_enabled = 1;
+
+        const char *info_env = getenv("GLIBC_MALLOC_PROFILE_INFO_SITES");
+        if (info_env) {
+            char *end = NULL;
+            unsigned long long v = strtoull(info_env, &end, 10);
+            if (end && *end == '\0')
+                mp_info_sites = v < MP_INFO_SITE_CAP ? v : MP_INFO_SITE_CAP;
+        }
+
+        if (mp_growth_pct != 0 || mp_growth_bytes != 0) {
+            mp_live_enabled = 1;
+            /* the first growth sets the baseline */
+            __atomic_store_n(&__mp_growth_next, 0, __ATOMIC_RELAXED);
+        }
+
+        if (mp_live_enabled)
+            mp_pagesize = (uintptr_t)sysconf(_SC_PAGESIZE);
+
     } else {
         mp_global_enabled = 0;
     }
 }
 
+
+/* ------------------------------------------------------
+ * Self-overhead clock
+ * ----------------------------------------------------*/
+
+/* Cheapest monotonic counter available.  MP_CYCLE_HZ is its rate when
+   known up front; 0 means TSC ticks of unknown frequency.  */
+#if defined(__x86_64__) || defined(__i386__)
+# define MP_CYCLE_HZ 0
+static inline uint64_t
+mp_cycles(void)
+{
+    return __builtin_ia32_rdtsc();
+}
+#elif defined(__aarch64__)
+# define MP_CYCLE_HZ mp_cntfrq()
+static inline uint64_t
+mp_cycles(void)
+{
+    uint64_t v;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+}
+static inline uint64_t
+mp_cntfrq(void)
+{
+    uint64_t v;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(v));
+    return v;
+}
+#else
+# define MP_CYCLE_HZ 1000000000ULL
+static inline uint64_t
+mp_cycles(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+/* Serialization cost of every dump written so far, process-wide.  */
+static uint64_t mp_dump_cycles;
+
+
+/* ------------------------------------------------------
+ * Sampling intervals
+ * ----------------------------------------------------*/
+
+/* By default the countdown restarts at the stride minus the overshoot,
+ * so every STRIDE-th byte is sampled.  GLIBC_MALLOC_PROFILE_RANDOM=1
+ * draws exponentially distributed intervals with the same mean instead,
+ * which cannot alias with periodic allocation patterns.  Each thread has
+ * its own generator; with GLIBC_MALLOC_PROFILE_SEED it is seeded from
+ * the seed and the order in which threads first allocated, so that
+ * identical runs sample identical allocations.  */
+
+#define MP_STRIDE_MAX (1ULL << 40)
+
+static uint64_t mp_thread_inits;             /* threads initialised so far */
+
+static inline uint64_t
+mp_splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static inline uint64_t
+mp_rng_next(struct __mp_tls *st)
+{
+    uint64_t x = st->rng;                    /* xorshift64* */
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    st->rng = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+/* log2(D) for D >= 1, to about 0.005; libc cannot use libm.  */
+static inline double
+mp_fast_log2(double d)
+{
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof bits);
+    /* The polynomial gives log2(M) + 1 for the mantissa M, so the
+       exponent is taken one lower than its unbiased value.  */
+    int exp = (int)((bits >> 52) & 0x7ff) - 1024;
+    bits = (bits & ((1ULL << 52) - 1)) | (1023ULL << 52);
+    double m;                                /* mantissa in [1, 2) */
+    memcpy(&m, &bits, sizeof m);
+    return exp + (-0.34484843 * m + 2.02466578) * m - 0.67487759;
+}
+
+/* Bytes until the next sample after one that overshot the countdown by
+   CONSUMED bytes.  */
+static inline uint64_t
+mp_next_interval(struct __mp_tls *st, uint64_t stride, uint64_t consumed)
+{
+    if (!mp_random)
+        return stride - consumed % stride;
+
+    /* -ln(U) * STRIDE with U uniform on (0, 1], from 26 random bits.  */
+    double q = (double)(mp_rng_next(st) >> 38) + 1.0;
+    double v = (26.0 - mp_fast_log2(q)) * 0.6931471805599453 * (double)stride;
+    if (v < 1.0)
+        return 1;
+    if (v >= (double)MP_STRIDE_MAX)
+        return MP_STRIDE_MAX;
+    return (uint64_t)v;
+}
+
+/* 1 - exp(-X) for X >= 0, to a few parts per million.  The series keeps
+   small X exact; larger X goes through 2^Y with Y = -X * log2(e).  */
+static inline double
+mp_fast_expm1_neg(double x)
+{
+    if (x < 0.5)
+        return x * (1.0 - x * (1.0 / 2 - x * (1.0 / 6 - x * (1.0 / 24
+               - x * (1.0 / 120 - x * (1.0 / 720 - x * (1.0 / 5040)))))));
+    double y = x * 1.4426950408889634;
+    if (y >= 60.0)
+        return 1.0;
+    int n = (int)y;
+    double f = (y - n) * -0.6931471805599453;  /* ln 2^-(Y-N), in (-ln2, 0] */
+    double e = 1.0 + f * (1.0 + f * (1.0 / 2 + f * (1.0 / 6 + f * (1.0 / 24
+               + f * (1.0 / 120 + f * (1.0 / 720 + f * (1.0 / 5040)))))));
+    uint64_t bits = (uint64_t)(1023 - n) << 52;
+    double scale;
+    memcpy(&scale, &bits, sizeof scale);
+    return 1.0 - e * scale;
+}
+
+/* Bytes of allocation represented by a sample of SIZE bytes that hit
+   SAMPLES strides.  With fixed intervals every STRIDE-th byte is
+   sampled, so that is exactly SAMPLES * STRIDE.  With exponential
+   intervals an allocation of SIZE bytes is sampled with probability
+   1 - exp(-SIZE / STRIDE), and weighting each sample by the inverse of
+   that keeps the estimate unbiased.  */
+static inline uint64_t
+mp_sample_estimate(uint64_t size, uint64_t stride, uint64_t samples)
+{
+    if (!mp_random)
+        return samples * stride;
+    double p = mp_fast_expm1_neg((double)size / (double)stride);
+    double est = (double)size / p;
+    return est < (double)size ? size : (uint64_t)est;
+}
+
 static inline void
 mp_thread_init_if_needed(struct __mp_tls *st)
 {
-    if (st->bytes_until_sample == 0)
-        st->bytes_until_sample = mp_sample_stride_bytes;
+    if (st->bytes_until_sample == 0) {
+        uint64_t index = __atomic_fetch_add(&mp_thread_inits, 1,
+                                            __ATOMIC_RELAXED);
+        st->thread_id = (uint32_t)index + 1;
+        st->rng = mp_splitmix64(mp_seeded ? mp_seed ^ mp_splitmix64(index)
+                                          : mp_cycles() ^ (uintptr_t)st);
+        if (st->rng == 0)
+            st->rng = 1;
+        st->stride = mp_sample_stride_bytes;
+        st->bytes_until_sample = mp_region_only
+                                 ? UINT64_MAX
+                                 : mp_next_interval(st, st->stride, 0);
+#ifdef MPROF_SHIM
+        __mp_shim_thread_start();
+#endif
+    }
+}
+
+
+/* ------------------------------------------------------
+ * Thread registry
+ * ----------------------------------------------------*/
+
+/* Seqlock write side.  Only the owning thread writes a record, so the
+   sequence update needs no read-modify-write: a plain store plus a
+   release fence to open, and a release store to close.  */
+static inline void
+mp_rec_write_begin(struct mp_thread_rec *r)
+{
+    __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void
+mp_rec_write_end(struct mp_thread_rec *r)
+{
+    __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void
+mp_rec_reset(struct mp_thread_rec *r)
+{
+    mp_rec_write_begin(r);
+    r->alloc_count = 0;
+    r->sample_count = 0;
+    r->site_overflow = 0;
+    memset(r->sites, 0, sizeof r->sites);
+    r->stride_changes = 0;
+    memset(&r->overhead, 0, sizeof r->overhead);
+    r->thread_index = __atomic_fetch_add(&mp_registry_joins, 1,
+                                         __ATOMIC_RELAXED);
+    mp_rec_write_end(r);
+}
+
+/* Attach the calling thread to a record: recycle one released by an
+   exited thread if possible, otherwise map a new one and push it.  Runs
+   once per thread, so atomics are fine here.  */
+static struct mp_thread_rec *
+mp_registry_join(void)
+{
+    struct mp_thread_rec *r;
+
+    for (r = __atomic_load_n(&mp_registry_head, __ATOMIC_ACQUIRE);
+         r != NULL; r = r->next) {
+        uint32_t expected = 0;
+        if (__atomic_load_n(&r->in_use, __ATOMIC_RELAXED) == 0
+            && __atomic_compare_exchange_n(&r->in_use, &expected, 1, 0,
+                                           __ATOMIC_ACQUIRE,
+                                           __ATOMIC_RELAXED)) {
+            mp_rec_reset(r);
+            return r;
+        }
+    }
+
+    void *p = mmap(NULL, sizeof *r, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    r = p;
+    r->in_use = 1;
+    r->thread_index = __atomic_fetch_add(&mp_registry_joins, 1,
+                                         __ATOMIC_RELAXED);
+
+    struct mp_thread_rec *head = __atomic_load_n(&mp_registry_head,
+                                                 __ATOMIC_RELAXED);
+    do
+        r->next = head;
+    while (!__atomic_compare_exchange_n(&mp_registry_head, &head, r, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return r;
+}
+
+static void
+mp_registry_leave(struct mp_thread_rec *r)
+{
+    __atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+}
+
+struct mp_thread_rec *
+__mp_registry_first(void)
+{
+    return __atomic_load_n(&mp_registry_head, __ATOMIC_ACQUIRE);
+}
+
+/* Seqlock read side.  Bounded, because the owner may be the very thread
+   that was interrupted to run the dumper and will never finish its
+   write.  */
+#define MP_SNAPSHOT_TRIES 64
+
+int
+__mp_rec_snapshot(const struct mp_thread_rec *rec, struct mp_thread_rec *out)
+{
+    for (int i = 0; i < MP_SNAPSHOT_TRIES; ++i) {
+        uint32_t s1 = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1)
+            continue;
+        memcpy(out, rec, sizeof *out);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == s1)
+            return 0;
+    }
+    return -1;
 }
 
 
@@ -76,9 +554,9 @@ mp_thread_init_if_needed(struct __mp_tls *st)
  * ----------------------------------------------------*/
 
 static inline size_t
-mp_hash_pc(uintptr_t pc)
+mp_hash_site(uintptr_t pc, uint32_t label)
 {
-    uint64_t x = (uint64_t)pc;
+    uint64_t x = (uint64_t)pc ^ ((uint64_t)label << 40);
     x ^= x >> 33;
     x *= 0xff51afd7ed558ccdULL;
     x ^= x >> 33;
@@ -87,207 +565,3266 @@ mp_hash_pc(uintptr_t pc)
     return (size_t)x;
 }
 
+/* One sampled allocation, as entered into the tables.  */
+struct mp_sample {
+    uintptr_t pc;
+    uint32_t  label;
+    uint64_t  size;              /* requested bytes */
+    uint64_t  usable;            /* malloc_usable_size of the result */
+    uint64_t  est;               /* samples x stride */
+    int       realloc_kind;      /* MP_REALLOC_*, -1 if not a realloc */
+    uint64_t  old_size;          /* realloc: usable size of the old block */
+    uint64_t  copied;            /* realloc: bytes copied */
+    int       calloc;            /* 1 for calloc */
+    uint64_t  cleared;           /* calloc: bytes zeroed */
+    uint64_t  resident;          /* live sets: estimated resident bytes */
+    uint32_t  thread;            /* __mp_tls.thread_id */
+    uint32_t  node;              /* NUMA node of the sampling CPU */
+};
+
+/* Histogram bucket of a SIZE-byte request; see MP_HIST_BUCKETS.  */
+static inline unsigned int
+mp_size_bucket(size_t size)
+{
+    if (size < 128)
+        return (unsigned int)(size >> 4);
+    unsigned int b = (unsigned int)(63 - __builtin_clzll(size)) + 1;
+    return b < MP_HIST_BUCKETS ? b : MP_HIST_BUCKETS - 1;
+}
+
 static inline void
-mp_record_site(struct __mp_tls *st, uintptr_t pc, size_t size)
+mp_record_site(struct mp_thread_rec *r, const struct mp_sample *smp)
 {
-    if (pc == 0)
+    if (smp->pc <= MP_SITE_BUSY)
         return;
 
     size_t cap = MP_SITE_CAP;
-    size_t idx = mp_hash_pc(pc) % cap;
+    size_t idx = mp_hash_site(smp->pc, smp->label) % cap;
 
     for (size_t probe = 0; probe < cap; ++probe) {
-        struct mp_site *s = &st->sites[idx];
+        struct mp_site *s = &r->sites[idx];
 
         if (s->pc == 0) {
             /* install new site */
-            s->pc = pc;
-            s->sample_count = 1;
-            s->total_bytes = size;
-            return;
+            s->pc = smp->pc;
+            s->label = smp->label;
         }
-        if (s->pc == pc) {
-            /* update existing */
+        if (s->pc == smp->pc && s->label == smp->label) {
             s->sample_count++;
-            s->total_bytes += size;
+            s->total_bytes += smp->size;
+            s->usable_bytes += smp->usable;
+            s->est_bytes += smp->est;
+            s->hist[mp_size_bucket(smp->size)]++;
+            if (smp->realloc_kind >= 0) {
+                s->realloc_old_bytes += smp->old_size;
+                s->realloc_copied += smp->copied;
+                s->realloc_count[smp->realloc_kind]++;
+            }
+            s->resident_bytes += smp->resident;
+            if (smp->calloc) {
+                s->calloc_count++;
+                if (smp->cleared != 0) {
+                    s->calloc_zeroed++;
+                    s->calloc_cleared += smp->cleared;
+                }
+            }
             return;
         }
         idx = (idx + 1) % cap;
     }
 
     /* table is full */
-    st->site_overflow++;
+    r->site_overflow++;
 }
 
 
 /* ------------------------------------------------------
- * Allocation hook called from malloc.c
+ * Labels
  * ----------------------------------------------------*/
 
-void
-__mp_on_alloc(size_t size, void *ptr)
+/* Interned (key, value) pairs.  A label's id is its slot + 1, so ids
+   stay small and 0 means "no label".  Lookups are lock-free; inserts
+   take a spinlock and publish the entry with a release store of READY,
+   after which it never changes.  */
+#define MP_LABEL_CAP 256
+#define MP_LABEL_LEN 64      /* key and value are truncated to fit */
+
+struct mp_label {
+    uint32_t ready;
+    uint32_t hash;
+    char key[MP_LABEL_LEN];
+    char value[MP_LABEL_LEN];
+};
+
+static struct mp_label *mp_labels;   /* MP_LABEL_CAP entries */
+static int mp_label_lock;
+
+/* Map the table on first intern, as for the per-CPU tables.  */
+static struct mp_label *
+mp_label_table_get(void)
 {
-    (void)ptr; /* not needed for aggregation */
+    struct mp_label *t = __atomic_load_n(&mp_labels, __ATOMIC_ACQUIRE);
+    if (__glibc_likely(t != NULL))
+        return t;
 
-    mp_global_init_if_needed();
-    if (!mp_global_enabled)
-        return;
+    size_t len = MP_LABEL_CAP * sizeof *t;
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    if (!__atomic_compare_exchange_n(&mp_labels, &t, p, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        (void)munmap(p, len);
+        return t;
+    }
+    return p;
+}
 
-    struct __mp_tls *st = &__mp_tls_state;
-    mp_thread_init_if_needed(st);
+static void
+mp_label_copy(char *dst, const char *src)
+{
+    memset(dst, 0, MP_LABEL_LEN);
+    if (src != NULL)
+        strncpy(dst, src, MP_LABEL_LEN - 1);
+}
 
-    st->alloc_count++;
+static uint32_t
+mp_label_hash(const char *key, const char *value)
+{
+    uint32_t h = 2166136261u;                    /* FNV-1a */
+    for (size_t i = 0; i < MP_LABEL_LEN && key[i]; ++i)
+        h = (h ^ (unsigned char)key[i]) * 16777619u;
+    h = (h ^ 0xff) * 16777619u;
+    for (size_t i = 0; i < MP_LABEL_LEN && value[i]; ++i)
+        h = (h ^ (unsigned char)value[i]) * 16777619u;
+    return h;
+}
 
-    uint64_t stride = mp_sample_stride_bytes;
-    uint64_t remaining = st->bytes_until_sample;
+/* Return the id of (KEY, VALUE), adding it if needed; 0 if the table is
+   full or cannot be mapped.  */
+static unsigned int
+mp_label_intern(const char *key, const char *value)
+{
+    struct mp_label *tab = mp_label_table_get();
+    if (tab == NULL)
+        return 0;
 
-    /* Fast path */
-    if (__glibc_likely(size < remaining)) {
-        st->bytes_until_sample = remaining - size;
-        return;
+    char k[MP_LABEL_LEN], v[MP_LABEL_LEN];
+    mp_label_copy(k, key);
+    mp_label_copy(v, value);
+    uint32_t h = mp_label_hash(k, v);
+
+    /* First pass without the lock; the second, locked pass also sees
+       entries added concurrently and may insert.  */
+    for (int locked = 0; locked < 2; ++locked) {
+        if (locked)
+            while (__atomic_exchange_n(&mp_label_lock, 1, __ATOMIC_ACQUIRE))
+                sched_yield();
+
+        size_t idx = h % MP_LABEL_CAP;
+        for (size_t probe = 0; probe < MP_LABEL_CAP; ++probe) {
+            struct mp_label *l = &tab[idx];
+            if (!__atomic_load_n(&l->ready, __ATOMIC_ACQUIRE)) {
+                if (!locked)
+                    break;
+                l->hash = h;
+                memcpy(l->key, k, sizeof k);
+                memcpy(l->value, v, sizeof v);
+                __atomic_store_n(&l->ready, 1, __ATOMIC_RELEASE);
+                __atomic_store_n(&mp_label_lock, 0, __ATOMIC_RELEASE);
+                return (unsigned int)idx + 1;
+            }
+            if (l->hash == h && memcmp(l->key, k, sizeof k) == 0
+                && memcmp(l->value, v, sizeof v) == 0) {
+                if (locked)
+                    __atomic_store_n(&mp_label_lock, 0, __ATOMIC_RELEASE);
+                return (unsigned int)idx + 1;
+            }
+            idx = (idx + 1) % MP_LABEL_CAP;
+        }
     }
 
-    /* Slow path: sample event */
-    size_t consumed = size - remaining;
-    uint64_t samples = 1 + consumed / stride;
+    __atomic_store_n(&mp_label_lock, 0, __ATOMIC_RELEASE);
+    return 0;
+}
 
-    st->sample_count += samples;
+static uint64_t
+mp_count_labels(void)
+{
+    struct mp_label *tab = __atomic_load_n(&mp_labels, __ATOMIC_ACQUIRE);
+    uint64_t n = 0;
+    if (tab == NULL)
+        return 0;
+    for (size_t i = 0; i < MP_LABEL_CAP; ++i)
+        n += __atomic_load_n(&tab[i].ready, __ATOMIC_ACQUIRE);
+    return n;
+}
 
-    /* capture caller PC one frame above */
-    uintptr_t pc = (uintptr_t)__builtin_return_address(0);
+unsigned int
+malloc_profile_label(const char *key, const char *value)
+{
+    return mp_label_intern(key, value);
+}
 
-    /* record sample */
-    mp_record_site(st, pc, size);
+unsigned int
+malloc_profile_set_label(const char *key, const char *value)
+{
+    unsigned int prev = __mp_tls_state.label;
+    __mp_tls_state.label = mp_label_intern(key, value);
+    return prev;
+}
 
-    /* reset bytes_until_sample */
-    uint64_t overshoot = consumed % stride;
-    st->bytes_until_sample = stride - overshoot;
+unsigned int
+malloc_profile_push_label(unsigned int id)
+{
+    unsigned int prev = __mp_tls_state.label;
+    __mp_tls_state.label = id;
+    return prev;
+}
+
+void
+malloc_profile_pop_label(unsigned int prev)
+{
+    __mp_tls_state.label = prev;
 }
 
 
 /* ------------------------------------------------------
- * Binary dump format
+ * Per-CPU aggregation
  * ----------------------------------------------------*/
 
-#define MP_MAGIC   0x4D50524F46494C45ULL   /* "MPROFILE" */
-#define MP_VERSION 1
+static struct mp_cpu_table *mp_cpu_tables;  /* mp_ncpus entries */
+static unsigned int mp_ncpus;
 
-struct mp_file_header {
-    uint64_t magic;
-    uint32_t version;
-    uint32_t reserved;
-    uint64_t stride_bytes;
-    uint64_t alloc_count;
-    uint64_t sample_count;
-    uint64_t site_overflow;
-    uint64_t n_sites;
-};
+/* Map the table array on first use.  Racing threads may both map; the
+   loser unmaps its copy.  */
+static struct mp_cpu_table *
+mp_cpu_tables_get(void)
+{
+    struct mp_cpu_table *t = __atomic_load_n(&mp_cpu_tables, __ATOMIC_ACQUIRE);
+    if (__glibc_likely(t != NULL))
+        return t;
 
-struct mp_file_site_disk {
-    uint64_t pc;
-    uint64_t sample_count;
-    uint64_t total_bytes;
-};
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    if (n < 1)
+        n = 1;
+    size_t len = (size_t)n * sizeof *t;
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
 
-static size_t
-mp_count_sites(const struct __mp_tls *st)
-{
-    size_t n = 0;
-    for (size_t i = 0; i < MP_SITE_CAP; ++i)
-        if (st->sites[i].pc != 0)
-            n++;
-    return n;
+    __atomic_store_n(&mp_ncpus, (unsigned int)n, __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&mp_cpu_tables, &t, p, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        (void)munmap(p, len);
+        return t;
+    }
+    return p;
 }
 
-static int
-mp_build_filename(char *buf, size_t buf_sz, const struct __mp_tls *st)
+/* sched_getcpu reads cpu_id from the thread's rseq area when the kernel
+   supports it, so this is a TLS load rather than a syscall.  */
+static inline struct mp_cpu_table *
+mp_cpu_table_self(void)
 {
-    if (!mp_out_base)
-        return -1;
-    pid_t pid = getpid();
-    int len = snprintf(buf, buf_sz, "%s.%d.%p.bin",
-                       mp_out_base, (int)pid, (void *)st);
-    return (len < 0 || (size_t)len >= buf_sz) ? -1 : 0;
+    struct mp_cpu_table *t = mp_cpu_tables_get();
+    if (t == NULL)
+        return NULL;
+    int cpu = sched_getcpu();
+    if (cpu < 0)
+        cpu = 0;
+    return &t[(unsigned int)cpu % mp_ncpus];
 }
 
+/* Record a sample in a table shared between threads (per-CPU tables
+   and regions).  */
 static void
-mp_dump_thread_to_file(const struct __mp_tls *st)
+mp_shared_record_site(struct mp_site *sites, uint64_t *overflow,
+                      const struct mp_sample *smp)
 {
-    if (!mp_out_base)
+    uintptr_t pc = smp->pc;
+    if (pc <= MP_SITE_BUSY)
         return;
 
-    if (st->alloc_count == 0 && st->sample_count == 0)
-        return;
+    size_t cap = MP_SITE_CAP;
+    size_t idx = mp_hash_site(pc, smp->label) % cap;
 
-    char path[256];
-    if (mp_build_filename(path, sizeof path, st) != 0)
-        return;
+    for (size_t probe = 0; probe < cap; ++probe) {
+        struct mp_site *s = &sites[idx];
+        uintptr_t cur = __atomic_load_n(&s->pc, __ATOMIC_ACQUIRE);
 
-    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC,
-                  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if (fd < 0)
+        if (cur == 0) {
+            /* Claim an empty slot, then publish the key.  A thread that
+               sees the slot busy probes on, which at worst splits a
+               site over two slots.  */
+            if (__atomic_compare_exchange_n(&s->pc, &cur, MP_SITE_BUSY, 0,
+                                            __ATOMIC_ACQUIRE,
+                                            __ATOMIC_ACQUIRE)) {
+                s->label = smp->label;
+                __atomic_store_n(&s->pc, pc, __ATOMIC_RELEASE);
+                cur = pc;
+            }
+        }
+        if (cur == pc && s->label == smp->label) {
+            __atomic_fetch_add(&s->sample_count, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&s->total_bytes, smp->size, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&s->usable_bytes, smp->usable,
+                               __ATOMIC_RELAXED);
+            __atomic_fetch_add(&s->est_bytes, smp->est, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&s->hist[mp_size_bucket(smp->size)], 1,
+                               __ATOMIC_RELAXED);
+            if (smp->realloc_kind >= 0) {
+                __atomic_fetch_add(&s->realloc_old_bytes, smp->old_size,
+                                   __ATOMIC_RELAXED);
+                __atomic_fetch_add(&s->realloc_copied, smp->copied,
+                                   __ATOMIC_RELAXED);
+                __atomic_fetch_add(&s->realloc_count[smp->realloc_kind], 1,
+                                   __ATOMIC_RELAXED);
+            }
+            if (smp->resident != 0)
+                __atomic_fetch_add(&s->resident_bytes, smp->resident,
+                                   __ATOMIC_RELAXED);
+            if (smp->calloc) {
+                __atomic_fetch_add(&s->calloc_count, 1, __ATOMIC_RELAXED);
+                if (smp->cleared != 0) {
+                    __atomic_fetch_add(&s->calloc_zeroed, 1,
+                                       __ATOMIC_RELAXED);
+                    __atomic_fetch_add(&s->calloc_cleared, smp->cleared,
+                                       __ATOMIC_RELAXED);
+                }
+            }
+            return;
+        }
+        idx = (idx + 1) % cap;
+    }
+
+    /* table is full */
+    __atomic_fetch_add(overflow, 1, __ATOMIC_RELAXED);
+}
+
+/* Move the thread's unflushed allocation count into the current CPU's
+   table.  */
+static void
+mp_cpu_flush_alloc_count(struct __mp_tls *st, struct mp_cpu_table *t)
+{
+    if (st->alloc_count == 0)
         return;
+    __atomic_fetch_add(&t->alloc_count, st->alloc_count, __ATOMIC_RELAXED);
+    /* Keep alloc_count - region_alloc_base right for an open region.  */
+    st->region_alloc_base -= st->alloc_count;
+    st->alloc_count = 0;
+}
 
-    struct mp_file_header hdr;
-    memset(&hdr, 0, sizeof hdr);
-    hdr.magic         = MP_MAGIC;
-    hdr.version       = MP_VERSION;
-    hdr.stride_bytes  = mp_sample_stride_bytes;
-    hdr.alloc_count   = st->alloc_count;
-    hdr.sample_count  = st->sample_count;
-    hdr.site_overflow = st->site_overflow;
-    hdr.n_sites       = mp_count_sites(st);
 
-    (void)write(fd, &hdr, sizeof hdr);
+/* ------------------------------------------------------
+ * Regions
+ * ----------------------------------------------------*/
 
-    for (size_t i = 0; i < MP_SITE_CAP; ++i) {
-        const struct mp_site *s = &st->sites[i];
-        if (s->pc == 0)
-            continue;
+static struct mp_region *mp_regions;   /* MP_REGION_CAP entries */
+static int mp_region_lock;
 
-        struct mp_file_site_disk fs;
-        fs.pc           = (uint64_t)s->pc;
-        fs.sample_count = s->sample_count;
-        fs.total_bytes  = s->total_bytes;
+static struct mp_region *
+mp_region_table_get(void)
+{
+    struct mp_region *t = __atomic_load_n(&mp_regions, __ATOMIC_ACQUIRE);
+    if (__glibc_likely(t != NULL))
+        return t;
 
-        (void)write(fd, &fs, sizeof fs);
+    size_t len = MP_REGION_CAP * sizeof *t;
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    if (!__atomic_compare_exchange_n(&mp_regions, &t, p, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        (void)munmap(p, len);
+        return t;
     }
-
-    (void)close(fd);
+    return p;
 }
 
-
-/* ------------------------------------------------------
- * Destructor: dump stats + binary snapshot
- * ----------------------------------------------------*/
-
-static void __attribute__((destructor))
-__mp_dump_stats_destructor(void)
+/* Return the id of the region called NAME, adding it if needed; 0 if
+   all MP_REGION_CAP regions are taken.  */
+static unsigned int
+mp_region_intern(const char *name)
 {
-    if (!mp_global_enabled)
-        return;
+    struct mp_region *tab = mp_region_table_get();
+    if (tab == NULL)
+        return 0;
 
-    struct __mp_tls *st = &__mp_tls_state;
+    char n[MP_REGION_NAME_LEN];
+    memset(n, 0, sizeof n);
+    if (name != NULL)
+        strncpy(n, name, sizeof n - 1);
 
-    if (st->alloc_count == 0 && st->sample_count == 0)
-        return;
+    unsigned int id = 0;
+    for (int locked = 0; locked < 2 && id == 0; ++locked) {
+        if (locked)
+            while (__atomic_exchange_n(&mp_region_lock, 1, __ATOMIC_ACQUIRE))
+                sched_yield();
+        for (size_t i = 0; i < MP_REGION_CAP; ++i) {
+            struct mp_region *g = &tab[i];
+            if (!__atomic_load_n(&g->ready, __ATOMIC_ACQUIRE)) {
+                if (locked) {
+                    memcpy(g->name, n, sizeof n);
+                    __atomic_store_n(&g->ready, 1, __ATOMIC_RELEASE);
+                    id = (unsigned int)i + 1;
+                }
+                break;
+            }
+            if (memcmp(g->name, n, sizeof n) == 0) {
+                id = (unsigned int)i + 1;
+                break;
+            }
+        }
+        if (locked)
+            __atomic_store_n(&mp_region_lock, 0, __ATOMIC_RELEASE);
+    }
+    return id;
+}
 
-    /* Optional human-readable stats. */
+static void
+mp_region_sample(struct __mp_tls *st, const struct mp_sample *smp,
+                 uint64_t samples)
+{
+    struct mp_region *g = &mp_regions[st->region - 1];
+    __atomic_fetch_add(&g->sample_count, samples, __ATOMIC_RELAXED);
+    mp_shared_record_site(g->sites, &g->site_overflow, smp);
+}
+
+/* Fold the thread's exact totals into its region and give the thread
+   back the countdown it had outside.  */
+static void
+mp_region_leave(struct __mp_tls *st)
+{
+    struct mp_region *g = &mp_regions[st->region - 1];
+    uint64_t bytes = st->region_bytes
+                     + (st->countdown_start - st->bytes_until_sample);
+    __atomic_fetch_add(&g->alloc_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g->alloc_count, st->alloc_count - st->region_alloc_base,
+                       __ATOMIC_RELAXED);
+
+    st->region = 0;
+    st->stride = st->outer_stride;
+    st->bytes_until_sample = st->outer_remaining;
+}
+
+/* Regions do not nest: beginning one ends the current one.  */
+void
+malloc_profile_region_begin(const char *name)
+{
+    mp_global_init_if_needed();
+    if (mp_global_enabled != 1)
+        return;
+
+    struct __mp_tls *st = &__mp_tls_state;
+    mp_thread_init_if_needed(st);
+    if (st->region != 0)
+        mp_region_leave(st);
+
+    unsigned int id = mp_region_intern(name);
+    if (id == 0)
+        return;
+
+    st->outer_stride = st->stride;
+    st->outer_remaining = st->bytes_until_sample;
+    st->region = id;
+    st->stride = mp_region_stride_bytes;
+    st->bytes_until_sample = mp_next_interval(st, st->stride, 0);
+    st->countdown_start = st->bytes_until_sample;
+    st->region_bytes = 0;
+    st->region_alloc_base = st->alloc_count;
+}
+
+void
+malloc_profile_region_end(void)
+{
+    struct __mp_tls *st = &__mp_tls_state;
+    if (st->region != 0)
+        mp_region_leave(st);
+}
+
+
+/* ------------------------------------------------------
+ * Live sampled allocations
+ * ----------------------------------------------------*/
+
+#define MP_LIVE_PROBE 64     /* slots searched before giving up */
+
+struct mp_live_table {
+    uint64_t untracked;      /* samples dropped because probing failed */
+    uint8_t filter[1U << MP_LIVE_FILTER_BITS];
+    struct mp_live entries[MP_LIVE_CAP];
+};
+
+static struct mp_live_table *mp_live;
+uint8_t *__mp_live_filter;
+static uint32_t mp_cold_epoch;   /* soft-dirty scans done, see mp_cold_scan */
+
+static struct mp_live_table *
+mp_live_table_get(void)
+{
+    struct mp_live_table *t = __atomic_load_n(&mp_live, __ATOMIC_ACQUIRE);
+    if (__glibc_likely(t != NULL))
+        return t;
+
+    void *p = mmap(NULL, sizeof *t, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    if (!__atomic_compare_exchange_n(&mp_live, &t, p, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        (void)munmap(p, sizeof *t);
+        return t;
+    }
+    t = p;
+    __atomic_store_n(&__mp_live_filter, t->filter, __ATOMIC_RELEASE);
+    return t;
+}
+
+static inline size_t
+mp_live_index(uintptr_t ptr)
+{
+    uint64_t h = ((uint64_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 32) % MP_LIVE_CAP;
+}
+
+/* Filter bytes stick at 255 rather than wrap, so a crowded bucket
+   costs needless lookups but never hides a live entry.  */
+static inline void
+mp_live_filter_inc(uint8_t *f)
+{
+    uint8_t cur = __atomic_load_n(f, __ATOMIC_RELAXED);
+    while (cur != UINT8_MAX
+           && !__atomic_compare_exchange_n(f, &cur, cur + 1, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static inline void
+mp_live_filter_dec(uint8_t *f)
+{
+    uint8_t cur = __atomic_load_n(f, __ATOMIC_RELAXED);
+    while (cur != 0 && cur != UINT8_MAX
+           && !__atomic_compare_exchange_n(f, &cur, cur - 1, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Enter the sampled allocation PTR.  Its filter byte is raised before
+   PTR is published, so a free racing with the insert (only possible
+   for a pointer the application has not been given yet) cannot miss
+   it.  Returns 0 if PTR could not be entered.  */
+static int
+mp_live_insert(uintptr_t ptr, const struct mp_sample *smp)
+{
+    struct mp_live_table *t = mp_live_table_get();
+    if (t == NULL || ptr <= MP_LIVE_BUSY)
+        return 0;
+
+    size_t idx = mp_live_index(ptr);
+    for (size_t probe = 0; probe < MP_LIVE_PROBE; ++probe) {
+        struct mp_live *e = &t->entries[idx];
+        uintptr_t cur = __atomic_load_n(&e->ptr, __ATOMIC_RELAXED);
+
+        if ((cur == 0 || cur == MP_LIVE_TOMB)
+            && __atomic_compare_exchange_n(&e->ptr, &cur, MP_LIVE_BUSY, 0,
+                                           __ATOMIC_ACQUIRE,
+                                           __ATOMIC_RELAXED)) {
+            e->pc = smp->pc;
+            e->label = smp->label;
+            e->size = smp->size;
+            e->usable = smp->usable;
+            e->est = smp->est;
+            e->born = __atomic_load_n(&mp_cold_epoch, __ATOMIC_RELAXED);
+            e->written = e->born;
+            e->thread = smp->thread;
+            e->node = smp->node;
+            mp_live_filter_inc(&t->filter[mp_live_filter_index((void *)ptr)]);
+            __atomic_store_n(&e->ptr, ptr, __ATOMIC_RELEASE);
+            return 1;
+        }
+        idx = (idx + 1) % MP_LIVE_CAP;
+    }
+
+    __atomic_fetch_add(&t->untracked, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Bytes of [PTR, PTR + LEN) on resident pages, by mincore.  Pages
+   whose state cannot be read count as resident.  */
+static uint64_t
+mp_resident_bytes(uintptr_t ptr, uint64_t len)
+{
+    unsigned char vec[512];
+    uintptr_t end = ptr + len;
+    uintptr_t page = ptr & -mp_pagesize;
+    uint64_t resident = 0;
+
+    while (page < end) {
+        size_t n = (end - page + mp_pagesize - 1) / mp_pagesize;
+        if (n > sizeof vec)
+            n = sizeof vec;
+        int ok = mincore((void *)page, n * mp_pagesize, vec) == 0;
+        for (size_t i = 0; i < n; ++i, page += mp_pagesize) {
+            if (ok && !(vec[i] & 1))
+                continue;
+            uintptr_t lo = page < ptr ? ptr : page;
+            uintptr_t hi = page + mp_pagesize < end ? page + mp_pagesize : end;
+            resident += hi - lo;
+        }
+    }
+    return resident;
+}
+
+static inline uint64_t
+mp_live_resident(const struct mp_live *e)
+{
+    if (e->usable == 0)
+        return 0;
+    uint64_t res = mp_resident_bytes(e->ptr, e->usable);
+    return (uint64_t)((double)e->est * (double)res / (double)e->usable);
+}
+
+/* Add every allocation in T to SITES, keyed by site as usual; returns
+   how many there were.  With RESIDENT, each also counts its estimated
+   resident bytes: its weight scaled by the resident share of its chunk.
+   That is a mincore call per entry, so only reports written outside
+   the allocator ask for it; peak and growth snapshots, captured from
+   inside an allocating call, do not.  Entries freed and reused during
+   the scan may be seen half-updated, which is harmless for an
+   estimate.  */
+static uint64_t
+mp_live_aggregate(const struct mp_live_table *t, struct mp_site *sites,
+                  uint64_t *overflow, int resident)
+{
+    uint64_t n = 0;
+    for (size_t i = 0; i < MP_LIVE_CAP; ++i) {
+        const struct mp_live *e = &t->entries[i];
+        if (__atomic_load_n(&e->ptr, __ATOMIC_ACQUIRE) <= MP_LIVE_BUSY)
+            continue;
+        struct mp_sample smp;
+        smp.pc     = e->pc;
+        smp.label  = e->label;
+        smp.size   = e->size;
+        smp.usable = e->usable;
+        smp.est    = e->est;
+        smp.realloc_kind = -1;
+        smp.calloc = 0;
+        smp.resident = resident ? mp_live_resident(e) : 0;
+        n++;
+        mp_shared_record_site(sites, overflow, &smp);
+    }
+    return n;
+}
+
+static void mp_peak_account(struct __mp_tls *st, int64_t delta);
+
+/* Slots go from empty to used and back to MP_LIVE_TOMB, never to empty
+   again, so an entry always sits before the first empty slot of its
+   probe sequence.  */
+void
+__mp_on_free(void *mem)
+{
+    struct mp_live_table *t = __atomic_load_n(&mp_live, __ATOMIC_ACQUIRE);
+    uintptr_t ptr = (uintptr_t)mem;
+    if (t == NULL || ptr <= MP_LIVE_BUSY)
+        return;
+
+    size_t idx = mp_live_index(ptr);
+    for (size_t probe = 0; probe < MP_LIVE_PROBE; ++probe) {
+        struct mp_live *e = &t->entries[idx];
+        uintptr_t cur = __atomic_load_n(&e->ptr, __ATOMIC_ACQUIRE);
+
+        if (cur == 0)
+            return;
+        if (cur == ptr) {
+            uint64_t est = e->est;
+            if (__atomic_compare_exchange_n(&e->ptr, &cur, MP_LIVE_TOMB, 0,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                mp_live_filter_dec(&t->filter[mp_live_filter_index(mem)]);
+                if (mp_peak_margin != 0)
+                    mp_peak_account(&__mp_tls_state, -(int64_t)est);
+                return;
+            }
+        }
+        idx = (idx + 1) % MP_LIVE_CAP;
+    }
+}
+
+/* __mp_on_free behind the filter test malloc.c does inline.  */
+static inline void
+mp_live_forget(void *mem)
+{
+    const uint8_t *filter = __mp_live_filter;
+    if (filter != NULL && filter[mp_live_filter_index(mem)] != 0)
+        __mp_on_free(mem);
+}
+
+
+/* ------------------------------------------------------
+ * Peak snapshots
+ * ----------------------------------------------------*/
+
+/* Estimated bytes in live sampled allocations.  Threads add their
+   changes once they reach mp_peak_batch, so the sum may trail the truth
+   by up to that much per thread.  */
+static int64_t mp_live_bytes;
+
+/* Live set by site, captured whenever mp_live_bytes passes the last
+   capture by GLIBC_MALLOC_PROFILE_PEAK bytes.  Written only under
+   mp_peak_lock.  */
+struct mp_peak {
+    uint64_t live_bytes;         /* mp_live_bytes at the capture */
+    uint64_t captures;
+    uint64_t outstanding;
+    uint64_t site_overflow;
+    struct mp_site sites[MP_SITE_CAP];
+};
+
+static struct mp_peak *mp_peak;
+static uint64_t mp_peak_mark;    /* live_bytes of the last capture */
+static int mp_peak_lock;
+
+static void
+mp_peak_capture(uint64_t live_bytes)
+{
+    /* Whoever holds the lock is capturing a peak at least as recent.  */
+    if (__atomic_exchange_n(&mp_peak_lock, 1, __ATOMIC_ACQUIRE))
+        return;
+
+    struct mp_live_table *t = __atomic_load_n(&mp_live, __ATOMIC_ACQUIRE);
+    if (mp_peak == NULL) {
+        void *p = mmap(NULL, sizeof *mp_peak, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED)
+            mp_peak = p;
+    }
+    if (t != NULL && mp_peak != NULL
+        && live_bytes >= mp_peak_mark + mp_peak_margin) {
+        struct mp_peak *pk = mp_peak;
+        memset(pk->sites, 0, sizeof pk->sites);
+        pk->site_overflow = 0;
+        pk->outstanding = mp_live_aggregate(t, pk->sites,
+                                            &pk->site_overflow, 0);
+        pk->live_bytes = live_bytes;
+        pk->captures++;
+        __atomic_store_n(&mp_peak_mark, live_bytes, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&mp_peak_lock, 0, __ATOMIC_RELEASE);
+}
+
+static void
+mp_peak_flush(struct __mp_tls *st)
+{
+    if (st->live_delta == 0)
+        return;
+    int64_t total = __atomic_add_fetch(&mp_live_bytes, st->live_delta,
+                                       __ATOMIC_RELAXED);
+    int grew = st->live_delta > 0;
+    st->live_delta = 0;
+    if (grew && total > 0
+        && (uint64_t)total >= __atomic_load_n(&mp_peak_mark, __ATOMIC_RELAXED)
+                              + mp_peak_margin)
+        mp_peak_capture((uint64_t)total);
+}
+
+/* DELTA is the est weight of a sampled allocation entering (positive)
+   or leaving the live table.  */
+static void
+mp_peak_account(struct __mp_tls *st, int64_t delta)
+{
+    st->live_delta += delta;
+    if (st->live_delta >= (int64_t)mp_peak_batch
+        || st->live_delta <= -(int64_t)mp_peak_batch)
+        mp_peak_flush(st);
+}
+
+
+/* ------------------------------------------------------
+ * Growth snapshots
+ * ----------------------------------------------------*/
+
+#define MP_GROWTH_MIN_STEP (1ULL << 20)  /* no snapshots closer than 1 MB */
+
+size_t __mp_growth_next = SIZE_MAX;
+static uint64_t mp_growth_pending;  /* heap bytes awaiting a snapshot */
+static uint64_t mp_growth_base;     /* heap bytes at the last snapshot */
+static uint64_t mp_growth_seq;      /* snapshots captured */
+
+/* Heap size that is GLIBC_MALLOC_PROFILE_GROWTH_PCT percent or
+   GLIBC_MALLOC_PROFILE_GROWTH_MB megabytes above BASE, whichever comes
+   first.  */
+static uint64_t
+mp_growth_threshold(uint64_t base)
+{
+    uint64_t step = UINT64_MAX;
+    if (mp_growth_pct != 0)
+        step = base / 100 * mp_growth_pct;
+    if (mp_growth_bytes != 0 && mp_growth_bytes < step)
+        step = mp_growth_bytes;
+    if (step < MP_GROWTH_MIN_STEP)
+        step = MP_GROWTH_MIN_STEP;
+    return step > SIZE_MAX - 1 - base ? SIZE_MAX - 1 : base + step;
+}
+
+/* Runs inside the allocator, so only notes the size; the snapshot is
+   captured by the next sample (mp_capture_growth).  */
+void
+__mp_on_heap_grow(size_t heap_bytes)
+{
+    size_t next = __atomic_load_n(&__mp_growth_next, __ATOMIC_RELAXED);
+    if (heap_bytes < next || next == SIZE_MAX)
+        return;
+    if (!__atomic_compare_exchange_n(&__mp_growth_next, &next,
+                                     mp_growth_threshold(heap_bytes), 0,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return;
+    __atomic_store_n(&mp_growth_pending, heap_bytes, __ATOMIC_RELEASE);
+}
+
+#ifdef MPROF_SHIM
+/* A stock glibc has no growth hook; poll its statistics every
+   MP_GROWTH_POLL samples instead.  */
+#define MP_GROWTH_POLL 64
+static uint64_t mp_growth_polls;
+
+static void
+mp_growth_poll(void)
+{
+    if (__atomic_load_n(&__mp_growth_next, __ATOMIC_RELAXED) == SIZE_MAX
+        || __atomic_fetch_add(&mp_growth_polls, 1, __ATOMIC_RELAXED)
+           % MP_GROWTH_POLL != 0)
+        return;
+    struct mallinfo2 mi = mallinfo2();
+    __mp_on_heap_grow(mi.arena + mi.hblkhd);
+}
+#endif
+
+static void mp_capture_growth(void);
+
+
+/* ------------------------------------------------------
+ * Adaptive stride
+ * ----------------------------------------------------*/
+
+#define MP_ADAPT_WINDOW 16                 /* samples per rate measurement */
+
+static inline uint64_t
+mp_clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+    if (clock_gettime(clk, &ts) != 0)
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Measure this thread's sample rate per second of its own CPU time over
+   the last MP_ADAPT_WINDOW samples and return the stride that brings it
+   to 3/4 of its share of the budget.  Raise the stride whenever the
+   share is exceeded; only lower it (never below the configured stride)
+   once the rate has fallen well under, so the stride does not
+   oscillate.  Returns 0 if the stride should stay.  */
+static uint64_t
+mp_adapt_stride(struct __mp_tls *st)
+{
+    if (++st->window_samples < MP_ADAPT_WINDOW)
+        return 0;
+
+    uint64_t now = mp_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    uint64_t elapsed = now - st->window_start_ns;
+    uint64_t first = st->window_start_ns == 0;
+    st->window_start_ns = now;
+    st->window_samples = 0;
+    if (first || now == 0)
+        return 0;
+    if (elapsed == 0)
+        elapsed = 1;
+
+    uint64_t target = mp_max_sps_per_cpu;
+    uint64_t rate = MP_ADAPT_WINDOW * 1000000000ULL / elapsed;
+    uint64_t aim = target - target / 4;
+    if (aim == 0)
+        aim = 1;
+
+    uint64_t stride = st->stride;
+    double scaled = (double)stride * (double)rate / (double)aim;
+    uint64_t want = scaled >= (double)MP_STRIDE_MAX
+                    ? MP_STRIDE_MAX : (uint64_t)scaled;
+    if (want < mp_sample_stride_bytes)
+        want = mp_sample_stride_bytes;
+
+    if (rate > target ? want > stride : want < stride / 2)
+        return want;
+    return 0;
+}
+
+static inline void
+mp_log_stride(struct mp_stride_change *log, uint64_t n, uint64_t stride)
+{
+    struct mp_stride_change *c = &log[n % MP_STRIDE_LOG_CAP];
+    c->time_ns = mp_clock_ns(CLOCK_MONOTONIC);
+    c->stride = stride;
+}
+
+
+/* ------------------------------------------------------
+ * Cold allocations
+ * ----------------------------------------------------*/
+
+/* MP_COLD_SCANS times per GLIBC_MALLOC_PROFILE_COLD_AGE, a sample scans
+   the live table.  Each allocation of at least GLIBC_MALLOC_PROFILE_COLD
+   bytes with a soft-dirty page (written since the last scan) is stamped
+   with the scan's epoch, then the soft-dirty bits of the process are
+   cleared.  An allocation is cold once it has lived for the age without
+   being written after reaching it.  Only pages wholly inside the block
+   are read: the others hold the chunk header or a neighbour.  */
+#define MP_COLD_SCANS 4
+#define MP_PAGEMAP_SOFT_DIRTY (1ULL << 55)
+
+static uint64_t mp_cold_next_ns;   /* time of the next scan */
+static uint64_t mp_cold_scans;
+static int mp_cold_lock;
+static int mp_cold_state;          /* 0 = not probed, 1 = on, -1 = off */
+static int mp_pagemap_fd = -1;
+static int mp_clear_refs_fd = -1;
+
+static int
+mp_cold_clear(void)
+{
+    return write(mp_clear_refs_fd, "4", 1) == 1 ? 0 : -1;
+}
+
+/* Whether a page in [START, END), both page-aligned, is soft-dirty.
+   Pages whose state cannot be read count as written.  */
+static int
+mp_cold_written(uintptr_t start, uintptr_t end)
+{
+    uint64_t buf[512];
+    uintptr_t page = start / mp_pagesize;
+    uintptr_t last = end / mp_pagesize;
+
+    while (page < last) {
+        size_t n = last - page < 512 ? last - page : 512;
+        ssize_t got = pread(mp_pagemap_fd, buf, n * sizeof buf[0],
+                            (off_t)(page * sizeof buf[0]));
+        if (got < (ssize_t)sizeof buf[0])
+            return 1;
+        n = (size_t)got / sizeof buf[0];
+        for (size_t i = 0; i < n; ++i)
+            if (buf[i] & MP_PAGEMAP_SOFT_DIRTY)
+                return 1;
+        page += n;
+    }
+    return 0;
+}
+
+/* Soft-dirty bits need a kernel built with CONFIG_MEM_SOFT_DIRTY.
+   Check on a page of our own that clearing and then writing it shows
+   up in pagemap before trusting them.  */
+static int
+mp_cold_open(void)
+{
+    mp_pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    mp_clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (mp_pagemap_fd < 0 || mp_clear_refs_fd < 0)
+        return 0;
+
+    volatile char *page = mmap(NULL, mp_pagesize, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED)
+        return 0;
+    uintptr_t start = (uintptr_t)page;
+    page[0] = 1;
+    int ok = mp_cold_clear() == 0
+             && !mp_cold_written(start, start + mp_pagesize);
+    page[0] = 2;
+    ok = ok && mp_cold_written(start, start + mp_pagesize);
+    (void)munmap((void *)page, mp_pagesize);
+    return ok;
+}
+
+static void
+mp_cold_close(void)
+{
+    if (mp_pagemap_fd >= 0)
+        (void)close(mp_pagemap_fd);
+    if (mp_clear_refs_fd >= 0)
+        (void)close(mp_clear_refs_fd);
+    mp_pagemap_fd = mp_clear_refs_fd = -1;
+}
+
+/* Called with mp_cold_lock held.  A write that lands between reading a
+   page's bit and the clear is missed, so an allocation can look a scan
+   older than it is.  */
+static void
+mp_cold_scan(void)
+{
+    if (mp_cold_state == 0) {
+        mp_cold_state = mp_cold_open() ? 1 : -1;
+        if (mp_cold_state < 0)
+            mp_cold_close();
+    }
+    struct mp_live_table *t = __atomic_load_n(&mp_live, __ATOMIC_ACQUIRE);
+    if (mp_cold_state < 0 || t == NULL)
+        return;
+
+    uint32_t epoch = __atomic_load_n(&mp_cold_epoch, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < MP_LIVE_CAP; ++i) {
+        struct mp_live *e = &t->entries[i];
+        uintptr_t ptr = __atomic_load_n(&e->ptr, __ATOMIC_ACQUIRE);
+        if (ptr <= MP_LIVE_BUSY || e->usable < mp_cold_min)
+            continue;
+        uintptr_t start = (ptr + mp_pagesize - 1) & -mp_pagesize;
+        uintptr_t end = (ptr + e->usable) & -mp_pagesize;
+        if (start < end && mp_cold_written(start, end))
+            __atomic_store_n(&e->written, epoch, __ATOMIC_RELAXED);
+    }
+    (void)mp_cold_clear();
+    __atomic_store_n(&mp_cold_epoch, epoch + 1, __ATOMIC_RELAXED);
+    mp_cold_scans++;
+}
+
+static void
+mp_cold_poll(void)
+{
+    uint64_t now = mp_clock_ns(CLOCK_MONOTONIC);
+    if (now < __atomic_load_n(&mp_cold_next_ns, __ATOMIC_RELAXED)
+        || __atomic_exchange_n(&mp_cold_lock, 1, __ATOMIC_ACQUIRE))
+        return;
+    if (now >= mp_cold_next_ns) {
+        __atomic_store_n(&mp_cold_next_ns,
+                         now + mp_cold_age_ns / MP_COLD_SCANS,
+                         __ATOMIC_RELAXED);
+        mp_cold_scan();
+    }
+    __atomic_store_n(&mp_cold_lock, 0, __ATOMIC_RELEASE);
+}
+
+
+/* ------------------------------------------------------
+ * False sharing
+ * ----------------------------------------------------*/
+
+/* Sampled allocations of at most GLIBC_MALLOC_PROFILE_FALSE_SHARING
+   usable bytes are entered in a direct-mapped table of cache lines,
+   each slot holding the last such allocation to cover a line with its
+   hash.  When a new one shares a line with a live allocation from
+   another thread, the pair of sites is counted.  Only sampled
+   neighbours are seen, so pairs need a stride that samples most small
+   allocations.  Sharing a line does not prove both threads write it:
+   the pairs are candidates for padding, not measured contention.  */
+#define MP_LINE_SIZE 64
+#define MP_LINE_BITS 16            /* lines remembered: 2^N */
+#define MP_FSHARE_PAIR_CAP 256
+
+struct mp_fshare_pair {
+    uintptr_t pc[2];               /* ordered by (pc, label) */
+    uint32_t  label[2];
+    uint64_t  events;              /* lines found shared */
+};
+
+struct mp_fshare {
+    uint64_t events;
+    uint64_t pair_overflow;        /* events no pair slot was left for */
+    uint64_t site_overflow;
+    struct mp_fshare_pair pairs[MP_FSHARE_PAIR_CAP];
+    struct mp_site sites[MP_SITE_CAP];   /* both sides of every event */
+    uintptr_t lines[1U << MP_LINE_BITS];
+};
+
+static struct mp_fshare *mp_fshare;
+static int mp_fshare_lock;
+
+static struct mp_fshare *
+mp_fshare_get(void)
+{
+    struct mp_fshare *fs = __atomic_load_n(&mp_fshare, __ATOMIC_ACQUIRE);
+    if (__glibc_likely(fs != NULL))
+        return fs;
+
+    void *p = mmap(NULL, sizeof *fs, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    if (!__atomic_compare_exchange_n(&mp_fshare, &fs, p, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        (void)munmap(p, sizeof *fs);
+        return fs;
+    }
+    return p;
+}
+
+static inline size_t
+mp_line_index(uintptr_t line)
+{
+    uint64_t h = (uint64_t)line * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> (64 - MP_LINE_BITS));
+}
+
+/* Copy the live entry for PTR into OUT; 0 if PTR is not live.  */
+static int
+mp_live_find(uintptr_t ptr, struct mp_live *out)
+{
+    struct mp_live_table *t = __atomic_load_n(&mp_live, __ATOMIC_ACQUIRE);
+    if (t == NULL || ptr <= MP_LIVE_BUSY)
+        return 0;
+
+    size_t idx = mp_live_index(ptr);
+    for (size_t probe = 0; probe < MP_LIVE_PROBE; ++probe) {
+        const struct mp_live *e = &t->entries[idx];
+        uintptr_t cur = __atomic_load_n(&e->ptr, __ATOMIC_ACQUIRE);
+
+        if (cur == 0)
+            return 0;
+        if (cur == ptr) {
+            *out = *e;
+            /* freed and maybe reused while copying */
+            return __atomic_load_n(&e->ptr, __ATOMIC_ACQUIRE) == ptr;
+        }
+        idx = (idx + 1) % MP_LIVE_CAP;
+    }
+    return 0;
+}
+
+static void
+mp_fshare_record(struct mp_fshare *fs, const struct mp_sample *a,
+                 const struct mp_live *b)
+{
+    struct mp_sample other;
+    memset(&other, 0, sizeof other);
+    other.pc     = b->pc;
+    other.label  = b->label;
+    other.size   = b->size;
+    other.usable = b->usable;
+    other.est    = b->est;
+    other.realloc_kind = -1;
+
+    uintptr_t pc[2] = { a->pc, b->pc };
+    uint32_t label[2] = { a->label, b->label };
+    if (pc[1] < pc[0] || (pc[1] == pc[0] && label[1] < label[0])) {
+        pc[0] = b->pc;
+        pc[1] = a->pc;
+        label[0] = b->label;
+        label[1] = a->label;
+    }
+    size_t idx = (mp_hash_site(pc[0], label[0])
+                  ^ mp_hash_site(pc[1], label[1]) * 31) % MP_FSHARE_PAIR_CAP;
+
+    while (__atomic_exchange_n(&mp_fshare_lock, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+    fs->events++;
+    mp_shared_record_site(fs->sites, &fs->site_overflow, a);
+    mp_shared_record_site(fs->sites, &fs->site_overflow, &other);
+    for (size_t probe = 0; ; ++probe) {
+        struct mp_fshare_pair *pr = &fs->pairs[idx];
+        if (probe == MP_FSHARE_PAIR_CAP) {
+            fs->pair_overflow++;
+            break;
+        }
+        if (pr->events == 0) {
+            pr->pc[0] = pc[0];
+            pr->pc[1] = pc[1];
+            pr->label[0] = label[0];
+            pr->label[1] = label[1];
+        }
+        if (pr->pc[0] == pc[0] && pr->pc[1] == pc[1]
+            && pr->label[0] == label[0] && pr->label[1] == label[1]) {
+            pr->events++;
+            break;
+        }
+        idx = (idx + 1) % MP_FSHARE_PAIR_CAP;
+    }
+    __atomic_store_n(&mp_fshare_lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Called for a small sampled allocation just entered in the live
+   table.  A slot whose allocation has been freed, or that only shares
+   the line's hash, is taken over without an event.  */
+static void
+mp_fshare_check(uintptr_t ptr, const struct mp_sample *smp)
+{
+    struct mp_fshare *fs = mp_fshare_get();
+    if (fs == NULL || smp->usable == 0)
+        return;
+
+    uintptr_t first = ptr / MP_LINE_SIZE;
+    uintptr_t last = (ptr + smp->usable - 1) / MP_LINE_SIZE;
+    for (uintptr_t line = first; line <= last; ++line) {
+        uintptr_t prev = __atomic_exchange_n(&fs->lines[mp_line_index(line)],
+                                             ptr, __ATOMIC_RELAXED);
+        struct mp_live e;
+        if (prev == 0 || prev == ptr || !mp_live_find(prev, &e)
+            || e.thread == smp->thread || e.usable == 0
+            || prev / MP_LINE_SIZE > line
+            || (prev + e.usable - 1) / MP_LINE_SIZE < line)
+            continue;
+        mp_fshare_record(fs, smp, &e);
+    }
+}
+
+
+/* ------------------------------------------------------
+ * NUMA nodes
+ * ----------------------------------------------------*/
+
+/* GLIBC_MALLOC_PROFILE_NUMA=1 notes the node each sample was taken on,
+   and at exit asks move_pages (with no target nodes, which only
+   queries) where the pages of every live sampled allocation are.
+   Pages not yet touched have no node and are counted apart.  Samples
+   taken on CPUs of nodes beyond the table are left out of the per-CPU
+   node counts.  Kernels without NUMA support fail the query; everything
+   is then on node 0, as it is on a single-node machine.  */
+#define MP_NUMA_NODES 16              /* higher nodes count as other */
+#define MP_NUMA_UNTOUCHED MP_NUMA_NODES
+
+struct mp_numa {
+    int single_node;                  /* move_pages unavailable */
+    uint32_t nodes;                   /* highest node seen + 1 */
+    uint64_t other_bytes;             /* nodes beyond the table, or unknown */
+    uint64_t site_overflow;
+    struct mp_site sites[MP_SITE_CAP];
+    /* estimated bytes by memory node, MP_NUMA_UNTOUCHED last */
+    uint64_t site_bytes[MP_SITE_CAP][MP_NUMA_NODES + 1];  /* by site slot */
+    uint64_t cpu_bytes[MP_NUMA_NODES][MP_NUMA_NODES + 1]; /* by CPU node */
+};
+
+static inline uint32_t
+mp_cpu_node(void)
+{
+    unsigned int cpu, node;
+    if (getcpu(&cpu, &node) != 0)
+        return 0;
+    return node;
+}
+
+/* Slot of site (PC, LABEL) in SITES, as placed by
+   mp_shared_record_site; -1 if it is not there.  */
+static ssize_t
+mp_site_slot(const struct mp_site *sites, uintptr_t pc, uint32_t label)
+{
+    size_t idx = mp_hash_site(pc, label) % MP_SITE_CAP;
+    for (size_t probe = 0; probe < MP_SITE_CAP; ++probe) {
+        const struct mp_site *s = &sites[idx];
+        if (s->pc == 0)
+            return -1;
+        if (s->pc == pc && s->label == label)
+            return (ssize_t)idx;
+        idx = (idx + 1) % MP_SITE_CAP;
+    }
+    return -1;
+}
+
+/* Spread the weight of live allocation E over BYTES by the node of
+   each page it covers, in proportion to its bytes on the page.  */
+static void
+mp_numa_pages(struct mp_numa *nm, const struct mp_live *e, uint64_t *bytes)
+{
+    void *pages[64];
+    int status[64];
+    uint64_t on[MP_NUMA_NODES + 2] = { 0 };    /* last: other */
+    uintptr_t end = e->ptr + e->usable;
+    uintptr_t page = e->ptr & -mp_pagesize;
+
+    while (page < end && !nm->single_node) {
+        size_t n = 0;
+        for (uintptr_t p = page; p < end && n < 64; p += mp_pagesize)
+            pages[n++] = (void *)p;
+        if (syscall(SYS_move_pages, 0, n, pages, NULL, status, 0) != 0) {
+            nm->single_node = 1;
+            break;
+        }
+        for (size_t i = 0; i < n; ++i, page += mp_pagesize) {
+            uintptr_t lo = page < e->ptr ? e->ptr : page;
+            uintptr_t hi = page + mp_pagesize < end ? page + mp_pagesize : end;
+            int node = status[i];
+            /* -EFAULT: only the shared zero page, i.e. never written */
+            if (node == -ENOENT || node == -EFAULT) {
+                node = MP_NUMA_UNTOUCHED;
+            } else if (node < 0 || node >= MP_NUMA_NODES) {
+                node = MP_NUMA_NODES + 1;
+            } else if ((uint32_t)node >= nm->nodes) {
+                nm->nodes = (uint32_t)node + 1;
+            }
+            on[node] += hi - lo;
+        }
+    }
+
+    if (nm->single_node || e->usable == 0) {
+        bytes[0] += e->est;
+        return;
+    }
+    for (int node = 0; node <= MP_NUMA_NODES + 1; ++node) {
+        if (on[node] == 0)
+            continue;
+        uint64_t share = (uint64_t)((double)e->est * (double)on[node]
+                                    / (double)e->usable);
+        if (node <= MP_NUMA_NODES)
+            bytes[node] += share;
+        else
+            nm->other_bytes += share;
+    }
+}
+
+
+/* ------------------------------------------------------
+ * Thread caches
+ * ----------------------------------------------------*/
+
+/* Each thread's tcache is registered in a slot when malloc.c sets it
+   up.  Like thread records, slots are profiler-owned, never freed and
+   recycled after their thread exits.  A report counts itself in
+   READERS while it reads through TCACHE; the exiting thread clears
+   TCACHE and waits for the readers to leave before malloc.c frees the
+   cache, so only an exiting thread ever waits, and only during a
+   report.  */
+struct mp_tcache_slot {
+    struct mp_tcache_slot *next;   /* registry link, never unlinked */
+    uint32_t in_use;
+    uint32_t readers;
+    void *tcache;                  /* NULL while being released */
+    pid_t tid;
+};
+
+#define MP_TCACHE_SLOTS_PER_MAP 64
+
+static struct mp_tcache_slot *mp_tcache_head;
+
+static struct mp_tcache_slot *
+mp_tcache_slot_claim(void)
+{
+    struct mp_tcache_slot *s;
+    for (s = __atomic_load_n(&mp_tcache_head, __ATOMIC_ACQUIRE); s;
+         s = s->next) {
+        uint32_t idle = 0;
+        if (__atomic_load_n(&s->in_use, __ATOMIC_RELAXED) == 0
+            && __atomic_compare_exchange_n(&s->in_use, &idle, 1, 0,
+                                           __ATOMIC_ACQUIRE,
+                                           __ATOMIC_RELAXED))
+            return s;
+    }
+
+    /* All taken: map a batch, keep the first and publish the rest.  */
+    size_t len = MP_TCACHE_SLOTS_PER_MAP * sizeof *s;
+    struct mp_tcache_slot *batch = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (batch == MAP_FAILED)
+        return NULL;
+    batch[0].in_use = 1;
+    for (size_t i = 0; i + 1 < MP_TCACHE_SLOTS_PER_MAP; ++i)
+        batch[i].next = &batch[i + 1];
+    struct mp_tcache_slot *last = &batch[MP_TCACHE_SLOTS_PER_MAP - 1];
+    struct mp_tcache_slot *head = __atomic_load_n(&mp_tcache_head,
+                                                  __ATOMIC_RELAXED);
+    do
+        last->next = head;
+    while (!__atomic_compare_exchange_n(&mp_tcache_head, &head, batch, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return batch;
+}
+
+void
+__mp_on_tcache(void *tcache)
+{
+    mp_global_init_if_needed();
+    if (!mp_global_enabled || !mp_tcache_enabled)
+        return;
+
+    struct __mp_tls *st = &__mp_tls_state;
+    struct mp_tcache_slot *s = st->tcache_slot;
+
+    if (tcache == NULL) {
+        if (s == NULL)
+            return;
+        __atomic_store_n(&s->tcache, NULL, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&s->readers, __ATOMIC_SEQ_CST) != 0)
+            sched_yield();
+        st->tcache_slot = NULL;
+        __atomic_store_n(&s->in_use, 0, __ATOMIC_RELEASE);
+        return;
+    }
+
+    if (s == NULL && (s = mp_tcache_slot_claim()) == NULL)
+        return;
+    s->tid = gettid();
+    __atomic_store_n(&s->tcache, tcache, __ATOMIC_RELEASE);
+    st->tcache_slot = s;
+}
+
+#ifndef MPROF_SHIM
+/* Add the bins of every registered tcache to OUT, then the arenas'.  */
+static size_t
+mp_tcache_collect(struct mp_free_bin *out, size_t n)
+{
+    size_t k = 0;
+    for (struct mp_tcache_slot *s = __atomic_load_n(&mp_tcache_head,
+                                                    __ATOMIC_ACQUIRE);
+         s != NULL && k < n; s = s->next) {
+        __atomic_fetch_add(&s->readers, 1, __ATOMIC_SEQ_CST);
+        void *tc = __atomic_load_n(&s->tcache, __ATOMIC_SEQ_CST);
+        if (tc != NULL) {
+            size_t got = __malloc_tcache_bins(tc, out + k, n - k);
+            for (size_t i = 0; i < got; ++i)
+                out[k + i].owner = (uint32_t)s->tid;
+            k += got;
+        }
+        __atomic_fetch_sub(&s->readers, 1, __ATOMIC_RELEASE);
+    }
+    return k + __malloc_arena_bins(out + k, n - k);
+}
+#endif
+
+
+/* ------------------------------------------------------
+ * Allocation hook called from malloc.c
+ * ----------------------------------------------------*/
+
+/* CALL holds what the entry point knows about the request beyond its
+   size (the realloc_kind ... cleared fields of a sample).  REPLACES is
+   the pointer a sampled realloc resized in place; its live entry gives
+   way to the new one.  */
+static __attribute__((always_inline)) inline void
+mp_account(size_t size, void *ptr, const void *caller,
+           const struct mp_sample *call, void *replaces)
+{
+    mp_global_init_if_needed();
+    if (!mp_global_enabled)
+        return;
+
+    struct __mp_tls *st = &__mp_tls_state;
+    mp_thread_init_if_needed(st);
+
+    st->alloc_count++;
+
+    uint64_t stride = st->stride;
+    uint64_t remaining = st->bytes_until_sample;
+
+    /* Fast path */
+    if (__glibc_likely(size < remaining)) {
+        st->bytes_until_sample = remaining - size;
+        return;
+    }
+
+    /* Slow path: sample event */
+#ifdef MPROF_SHIM
+    mp_growth_poll();
+#endif
+    if (__glibc_unlikely(__atomic_load_n(&mp_growth_pending,
+                                         __ATOMIC_RELAXED) != 0))
+        mp_capture_growth();
+    if (mp_cold_min != 0)
+        mp_cold_poll();
+
+    uint64_t t0 = mp_cycles();
+    size_t consumed = size - remaining;
+    uint64_t samples = 1 + consumed / stride;
+
+    /* call site, as captured by the malloc entry point */
+    struct mp_sample smp = *call;
+    uint64_t t1 = mp_cycles();
+    smp.pc     = (uintptr_t)caller;
+    smp.label  = st->label;
+    smp.size   = size;
+    smp.usable = mp_usable_size(ptr);
+    smp.est    = mp_sample_estimate(size, stride, samples);
+    smp.thread = st->thread_id;
+    if (mp_numa_enabled)
+        smp.node = mp_cpu_node();
+    uint64_t t2 = mp_cycles();
+
+    if (replaces != NULL)
+        mp_live_forget(replaces);
+    if (mp_live_enabled && mp_live_insert((uintptr_t)ptr, &smp)) {
+        if (mp_peak_margin != 0)
+            mp_peak_account(st, (int64_t)smp.est);
+        if (smp.usable <= mp_fshare_max)
+            mp_fshare_check((uintptr_t)ptr, &smp);
+    }
+
+    if (st->region != 0) {
+        st->region_bytes += st->countdown_start - remaining + size;
+        st->bytes_until_sample = mp_next_interval(st, stride, consumed);
+        st->countdown_start = st->bytes_until_sample;
+        mp_region_sample(st, &smp, samples);
+        return;
+    }
+
+    /* pick the stride for the next interval */
+    uint64_t new_stride = mp_max_sps ? mp_adapt_stride(st) : 0;
+    if (new_stride != 0)
+        st->stride = new_stride;
+
+    /* reset bytes_until_sample */
+    st->bytes_until_sample = mp_next_interval(st, st->stride, consumed);
+
+    if (mp_percpu_enabled) {
+        struct mp_cpu_table *t = mp_cpu_table_self();
+        if (t == NULL)
+            return;
+        mp_cpu_flush_alloc_count(st, t);
+        __atomic_fetch_add(&t->sample_count, samples, __ATOMIC_RELAXED);
+        mp_shared_record_site(t->sites, &t->site_overflow, &smp);
+        uint64_t t3 = mp_cycles();
+        if (new_stride != 0)
+            mp_log_stride(t->stride_log,
+                          __atomic_fetch_add(&t->stride_changes, 1,
+                                             __ATOMIC_RELAXED),
+                          new_stride);
+        struct mp_overhead *o = &t->overhead;
+        __atomic_fetch_add(&o->unwind_cycles, t2 - t1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&o->insert_cycles, t3 - t2, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&o->slow_cycles, mp_cycles() - t0,
+                           __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (__glibc_unlikely(st->rec == NULL)) {
+        st->rec = mp_registry_join();
+        if (st->rec == NULL)
+            return;
+    }
+    struct mp_thread_rec *r = st->rec;
+
+    /* record sample */
+    mp_rec_write_begin(r);
+    r->alloc_count = st->alloc_count;
+    r->sample_count += samples;
+    mp_record_site(r, &smp);
+    uint64_t t3 = mp_cycles();
+    if (new_stride != 0)
+        mp_log_stride(r->stride_log, r->stride_changes++, new_stride);
+    r->overhead.unwind_cycles += t2 - t1;
+    r->overhead.insert_cycles += t3 - t2;
+    r->overhead.slow_cycles += mp_cycles() - t0;
+    mp_rec_write_end(r);
+}
+
+static const struct mp_sample mp_plain_call = { .realloc_kind = -1 };
+
+void
+__mp_on_alloc(size_t size, void *ptr, const void *caller)
+{
+    mp_account(size, ptr, caller, &mp_plain_call, NULL);
+}
+
+/* ------------------------------------------------------
+ * Large allocations
+ * ----------------------------------------------------*/
+
+static struct mp_large_table *mp_large;
+
+static struct mp_large_table *
+mp_large_table_get(void)
+{
+    struct mp_large_table *t = __atomic_load_n(&mp_large, __ATOMIC_ACQUIRE);
+    if (__glibc_likely(t != NULL))
+        return t;
+
+    void *p = mmap(NULL, sizeof *t, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    if (!__atomic_compare_exchange_n(&mp_large, &t, p, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        (void)munmap(p, sizeof *t);
+        return t;
+    }
+    return p;
+}
+
+/* Large requests are rare, so each takes what is the slow path for a
+   sampled one, weighted by its own size.  They enter the live table
+   like samples, so leak reports and snapshots include them, and count
+   towards the thread's allocations and its region's exact totals like
+   any other request.  CALL and REPLACES are as for mp_account.  */
+static void
+mp_account_large(size_t size, void *ptr, const void *caller,
+                 const struct mp_sample *call, void *replaces)
+{
+    mp_global_init_if_needed();
+    if (!mp_global_enabled)
+        return;
+
+    struct __mp_tls *st = &__mp_tls_state;
+    mp_thread_init_if_needed(st);
+
+    st->alloc_count++;
+    if (st->region != 0)
+        st->region_bytes += size;
+
+    if (__glibc_unlikely(__atomic_load_n(&mp_growth_pending,
+                                         __ATOMIC_RELAXED) != 0))
+        mp_capture_growth();
+    if (mp_cold_min != 0)
+        mp_cold_poll();
+
+    struct mp_large_table *t = mp_large_table_get();
+    if (t == NULL)
+        return;
+
+    struct mp_sample smp = *call;
+    smp.pc     = (uintptr_t)caller;
+    smp.label  = st->label;
+    smp.size   = size;
+    smp.usable = mp_usable_size(ptr);
+    smp.est    = size;
+    smp.thread = st->thread_id;
+    if (mp_numa_enabled)
+        smp.node = mp_cpu_node();
+
+    __atomic_fetch_add(&t->alloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&t->alloc_bytes, size, __ATOMIC_RELAXED);
+    mp_shared_record_site(t->sites, &t->site_overflow, &smp);
+    if (st->region != 0)
+        mp_region_sample(st, &smp, 1);
+
+    if (replaces != NULL)
+        mp_live_forget(replaces);
+    if (mp_live_enabled
+        && mp_live_insert((uintptr_t)ptr, &smp)
+        && mp_peak_margin != 0)
+        mp_peak_account(st, (int64_t)smp.est);
+}
+
+void
+__mp_on_large(size_t size, void *ptr, int calloc, size_t cleared,
+              const void *caller)
+{
+    struct mp_sample call = { .realloc_kind = -1, .calloc = calloc != 0,
+                              .cleared = cleared };
+    mp_account_large(size, ptr, caller, &call, NULL);
+}
+
+void
+__mp_on_calloc(size_t size, void *ptr, size_t cleared, const void *caller)
+{
+    struct mp_sample call = { .realloc_kind = -1, .calloc = 1,
+                              .cleared = cleared };
+    mp_account(size, ptr, caller, &call, NULL);
+}
+
+/* A realloc that moved the block frees the old one whether or not it is
+   sampled; one that resized in place keeps its live entry unless the
+   realloc is sampled and replaces it.  */
+void
+__mp_on_realloc(void *oldmem, void *newmem, size_t size, size_t old_size,
+                unsigned int kind, size_t copied, int large,
+                const void *caller)
+{
+    if (oldmem != NULL && oldmem != newmem)
+        mp_live_forget(oldmem);
+    if (kind >= MP_REALLOC_KINDS)
+        kind = MP_REALLOC_COPY;
+    struct mp_sample call = { .realloc_kind = (int)kind,
+                              .old_size = old_size, .copied = copied };
+    void *replaces = oldmem == newmem ? oldmem : NULL;
+    if (large)
+        mp_account_large(size, newmem, caller, &call, replaces);
+    else
+        mp_account(size, newmem, caller, &call, replaces);
+}
+
+
+/* ------------------------------------------------------
+ * Binary dump format
+ * ----------------------------------------------------*/
+
+#define MP_MAGIC   0x4D50524F46494C45ULL   /* "MPROFILE" */
+#define MP_VERSION 2
+
+/* Version 2 layout:
+ *
+ *   mp_file_header                (header_size bytes)
+ *   n_sites x mp_file_site_disk   (site_size bytes each)
+ *   n_sections x { mp_file_section, n_recs x rec_size bytes }
+ *
+ * Readers should honour the recorded sizes and skip unknown section
+ * tags so that fields and sections can be appended without a version
+ * bump.  Version 1 files stop after the sites and have no sizes
+ * (the field now holding header_size was reserved and zero).  */
+struct mp_file_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t stride_bytes;       /* configured (minimum) stride */
+    uint64_t alloc_count;
+    uint64_t sample_count;
+    uint64_t site_overflow;
+    uint64_t n_sites;
+    uint32_t site_size;
+    uint32_t n_sections;
+    uint64_t est_bytes;          /* sum of site est_bytes */
+    uint64_t slow_cycles;        /* self-overhead of this table, see */
+    uint64_t unwind_cycles;      /*   struct mp_overhead */
+    uint64_t insert_cycles;
+    uint64_t dump_cycles;        /* process-wide, dumps before this one */
+    uint64_t cycle_hz;           /* 0 = TSC ticks, rate unknown */
+};
+
+struct mp_file_site_disk {
+    uint64_t pc;
+    uint64_t sample_count;
+    uint64_t total_bytes;
+    uint64_t est_bytes;
+    uint64_t label;              /* id in the label section, 0 = none */
+    uint64_t module;             /* id in the module section, 0 = unknown */
+    uint64_t offset;             /* pc relative to the module's load address */
+    uint64_t usable_bytes;       /* usable size of the sampled chunks */
+    uint32_t hist[MP_HIST_BUCKETS];  /* see mp_size_bucket */
+    uint64_t realloc_old_bytes;  /* realloc samples: old usable sizes */
+    uint64_t realloc_copied;     /* realloc samples: bytes copied */
+    uint32_t realloc_count[MP_REALLOC_KINDS];  /* by MP_REALLOC_* */
+    uint64_t calloc_cleared;     /* calloc samples: bytes zeroed */
+    uint32_t calloc_count;       /* calloc samples */
+    uint32_t calloc_zeroed;      /* calloc samples that zeroed memory */
+    uint64_t resident_bytes;     /* live sets: estimated resident bytes */
+};
+
+struct mp_file_section {
+    uint32_t tag;
+    uint32_t rec_size;
+    uint64_t n_recs;
+};
+
+#define MP_SECTION_STRIDE_LOG 1  /* mp_stride_change, oldest first */
+#define MP_SECTION_LABELS     2  /* mp_file_label, the whole dictionary */
+#define MP_SECTION_REGION     3  /* one mp_file_region, region dumps only */
+#define MP_SECTION_MODULES    4  /* mp_file_module for each site module */
+#define MP_SECTION_LEAKS      5  /* one mp_file_leaks, leak reports only */
+#define MP_SECTION_PEAK       6  /* one mp_file_peak, peak snapshots only */
+#define MP_SECTION_GROWTH     7  /* one mp_file_growth, growth snapshots only */
+#define MP_SECTION_LARGE      8  /* one mp_file_large, large-allocation dumps */
+#define MP_SECTION_COLD       9  /* one mp_file_cold, cold reports only */
+#define MP_SECTION_FSHARE    10  /* one mp_file_fshare, false-sharing reports */
+#define MP_SECTION_FSHARE_PAIRS 11  /* mp_file_fshare_pair, by events */
+#define MP_SECTION_NUMA      12  /* one mp_file_numa, NUMA reports only */
+#define MP_SECTION_NUMA_SITES 13    /* mp_file_numa_bytes by site */
+#define MP_SECTION_NUMA_CPUS 14  /* mp_file_numa_bytes by CPU node */
+#define MP_SECTION_FREE_BINS 15  /* mp_free_bin, thread cache reports only */
+
+struct mp_file_label {
+    uint32_t id;
+    uint32_t reserved;
+    char key[MP_LABEL_LEN];
+    char value[MP_LABEL_LEN];
+};
+
+#define MP_MODULE_PATH_LEN 256
+
+struct mp_file_module {
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t load_addr;
+    char path[MP_MODULE_PATH_LEN];   /* "" for the main program */
+};
+
+struct mp_file_region {
+    char name[MP_REGION_NAME_LEN];
+    uint64_t alloc_bytes;        /* exact; the header has the exact count */
+};
+
+/* In a leak report each site is a group of sampled allocations still
+   live at exit: sample_count is how many, est_bytes their weight.  */
+struct mp_file_leaks {
+    uint64_t outstanding;        /* live sampled allocations */
+    uint64_t untracked;          /* samples the live table had no room for */
+};
+
+/* A peak snapshot lists the live sampled allocations at the largest
+   live_bytes seen, grouped by site like a leak report.  */
+struct mp_file_peak {
+    uint64_t live_bytes;         /* estimated live bytes at the capture */
+    uint64_t captures;           /* snapshots taken, each a new maximum */
+};
+
+/* Growth snapshot N lists the live sampled allocations when the heap
+   (arena system_mem plus mmapped chunks) first reached HEAP_BYTES.
+   Diffing snapshot N against N-1 shows which sites grew in between.  */
+struct mp_file_growth {
+    uint64_t seq;                /* N, also in the file name */
+    uint64_t heap_bytes;
+    uint64_t prev_heap_bytes;    /* heap_bytes of snapshot N-1, 0 for N=1 */
+};
+
+/* The large-allocation dump records every request of at least
+   THRESHOLD bytes (0: the allocator's mmap threshold at the time);
+   sample_count is the number of allocations and est_bytes is exact.  */
+struct mp_file_large {
+    uint64_t threshold;
+    uint64_t alloc_bytes;
+};
+
+/* A cold report lists, by site, the live sampled allocations of at
+   least MIN_SIZE bytes that are older than AGE_NS and were not written
+   after reaching that age.  AGED counts all allocations old enough to
+   judge, cold or not.  */
+struct mp_file_cold {
+    uint64_t min_size;
+    uint64_t age_ns;
+    uint64_t scans;              /* soft-dirty scans done */
+    uint64_t aged;
+    uint64_t aged_bytes;         /* estimated */
+};
+
+/* A false-sharing report lists every site seen on either side of a
+   cache line shared across threads, sample_count being the lines it
+   was involved in.  EVENTS counts the lines; the pairs section says
+   which two sites shared them.  */
+struct mp_file_fshare {
+    uint64_t line_size;
+    uint64_t max_size;           /* GLIBC_MALLOC_PROFILE_FALSE_SHARING */
+    uint64_t events;
+    uint64_t pair_overflow;      /* events not attributed to a pair */
+};
+
+/* SITE indexes the sites of the file, from 0; UINT32_MAX if the site
+   did not fit in the table.  */
+struct mp_file_fshare_pair {
+    uint32_t site[2];
+    uint64_t events;
+};
+
+/* A NUMA report lists the live sampled allocations by site, like a
+   leak report, and splits their estimated bytes by the node their
+   pages are on: per site, and per node of the CPU that sampled them.  */
+struct mp_file_numa {
+    uint32_t nodes;              /* highest memory node seen + 1 */
+    uint32_t single_node;        /* 1: no node information, all on 0 */
+    uint64_t other_bytes;        /* on nodes beyond the table, or unknown */
+};
+
+/* KEY is the site index in the file (NUMA_SITES) or the CPU's node
+   (NUMA_CPUS).  NODE is UINT32_MAX for pages not yet touched.  */
+struct mp_file_numa_bytes {
+    uint32_t key;
+    uint32_t node;
+    uint64_t est_bytes;
+};
+
+/* What gets written for one table, independent of where it lives.  */
+struct mp_profile_view {
+    uint64_t stride;             /* configured stride for this table */
+    const struct mp_region *region;  /* set for region tables */
+    const struct mp_file_leaks *leaks;  /* set for the leak report */
+    const struct mp_file_peak *peak;    /* set for the peak snapshot */
+    const struct mp_file_growth *growth;  /* set for growth snapshots */
+    const struct mp_file_large *large;    /* set for large allocations */
+    const struct mp_file_cold *cold;      /* set for the cold report */
+    const struct mp_file_fshare *fshare;  /* set for false sharing, */
+    const struct mp_fshare_pair *pairs;   /*   with its pairs */
+    const struct mp_file_numa *numa;      /* set for the NUMA report, */
+    const struct mp_numa *numa_bytes;     /*   with its byte counts */
+    const struct mp_free_bin *free_bins;  /* thread cache report */
+    uint64_t n_free_bins;
+    uint64_t alloc_count;
+    uint64_t sample_count;
+    uint64_t site_overflow;
+    const struct mp_site *sites;
+    uint64_t stride_changes;
+    const struct mp_stride_change *stride_log;
+    struct mp_overhead overhead;
+};
+
+static void
+mp_write_section(int fd, uint32_t tag, uint32_t rec_size, uint64_t n_recs)
+{
+    struct mp_file_section sec;
+    sec.tag      = tag;
+    sec.rec_size = rec_size;
+    sec.n_recs   = n_recs;
+    (void)write(fd, &sec, sizeof sec);
+}
+
+/* Sites as written: resolved to (module, offset) and sorted by them,
+   so that dumps do not depend on where modules were loaded.  */
+struct mp_dump_site {
+    const struct mp_site *site;
+    const struct link_map *map;  /* NULL if not in any module */
+    uint64_t offset;
+    uint32_t module;
+};
+
+struct mp_dump_scratch {
+    size_t n_sites;
+    size_t n_modules;
+    struct mp_dump_site sites[MP_SITE_CAP];
+    const struct link_map *modules[MP_SITE_CAP];   /* sorted by path */
+};
+
+static inline const char *
+mp_module_name(const struct link_map *map)
+{
+    return map->l_name != NULL ? map->l_name : "";
+}
+
+static int
+mp_dump_site_less(const struct mp_dump_site *a, const struct mp_dump_site *b)
+{
+    if (a->module != b->module)
+        return a->module < b->module;
+    if (a->offset != b->offset)
+        return a->offset < b->offset;
+    return a->site->label < b->site->label;
+}
+
+/* Take the live sites of SITES once, so that the count in the header
+   matches what is written even if the table is being updated.  */
+static void
+mp_resolve_sites(const struct mp_site *sites, struct mp_dump_scratch *d)
+{
+    d->n_sites = 0;
+    d->n_modules = 0;
+    for (size_t i = 0; i < MP_SITE_CAP; ++i) {
+        const struct mp_site *s = &sites[i];
+        uintptr_t pc = __atomic_load_n(&s->pc, __ATOMIC_ACQUIRE);
+        if (pc <= MP_SITE_BUSY)
+            continue;
+
+        struct mp_dump_site *ds = &d->sites[d->n_sites++];
+        struct dl_find_object obj;
+        ds->site = s;
+        ds->map = NULL;
+        ds->offset = pc;
+        if (_dl_find_object((void *)pc, &obj) == 0) {
+            ds->map = obj.dlfo_link_map;
+            ds->offset = pc - ds->map->l_addr;
+        }
+        if (ds->map == NULL)
+            continue;
+
+        /* insert the module by path, if new */
+        const char *name = mp_module_name(ds->map);
+        size_t j = d->n_modules;
+        size_t k;
+        for (k = 0; k < d->n_modules && d->modules[k] != ds->map; ++k)
+            ;
+        if (k < d->n_modules)
+            continue;
+        while (j > 0 && strcmp(mp_module_name(d->modules[j - 1]), name) > 0) {
+            d->modules[j] = d->modules[j - 1];
+            --j;
+        }
+        d->modules[j] = ds->map;
+        d->n_modules++;
+    }
+
+    for (size_t i = 0; i < d->n_sites; ++i) {
+        struct mp_dump_site *ds = &d->sites[i];
+        ds->module = 0;
+        for (size_t k = 0; ds->map != NULL && k < d->n_modules; ++k)
+            if (d->modules[k] == ds->map)
+                ds->module = (uint32_t)k + 1;
+    }
+
+    for (size_t i = 1; i < d->n_sites; ++i) {
+        struct mp_dump_site tmp = d->sites[i];
+        size_t j = i;
+        while (j > 0 && mp_dump_site_less(&tmp, &d->sites[j - 1])) {
+            d->sites[j] = d->sites[j - 1];
+            --j;
+        }
+        d->sites[j] = tmp;
+    }
+}
+
+/* Index of site (PC, LABEL) among the sites written.  */
+static uint32_t
+mp_dump_site_index(const struct mp_dump_scratch *d, uintptr_t pc,
+                   uint32_t label)
+{
+    for (size_t i = 0; i < d->n_sites; ++i)
+        if (d->sites[i].site->pc == pc && d->sites[i].site->label == label)
+            return (uint32_t)i;
+    return UINT32_MAX;
+}
+
+/* PAIRS in decreasing order of events.  */
+static void
+mp_write_fshare_pairs(int fd, const struct mp_fshare_pair *pairs,
+                      const struct mp_dump_scratch *d)
+{
+    struct mp_file_fshare_pair out[MP_FSHARE_PAIR_CAP];
+    size_t n = 0;
+    for (size_t i = 0; i < MP_FSHARE_PAIR_CAP; ++i) {
+        const struct mp_fshare_pair *pr = &pairs[i];
+        if (pr->events == 0)
+            continue;
+        struct mp_file_fshare_pair fp;
+        fp.site[0] = mp_dump_site_index(d, pr->pc[0], pr->label[0]);
+        fp.site[1] = mp_dump_site_index(d, pr->pc[1], pr->label[1]);
+        fp.events  = pr->events;
+        size_t j = n++;
+        while (j > 0 && out[j - 1].events < fp.events) {
+            out[j] = out[j - 1];
+            --j;
+        }
+        out[j] = fp;
+    }
+    mp_write_section(fd, MP_SECTION_FSHARE_PAIRS, sizeof out[0], n);
+    (void)write(fd, out, n * sizeof out[0]);
+}
+
+static void
+mp_write_numa_row(int fd, uint32_t key, const uint64_t *bytes)
+{
+    for (uint32_t node = 0; node <= MP_NUMA_NODES; ++node) {
+        if (bytes[node] == 0)
+            continue;
+        struct mp_file_numa_bytes fb;
+        fb.key       = key;
+        fb.node      = node == MP_NUMA_UNTOUCHED ? UINT32_MAX : node;
+        fb.est_bytes = bytes[node];
+        (void)write(fd, &fb, sizeof fb);
+    }
+}
+
+static uint64_t
+mp_numa_row_count(const uint64_t *bytes)
+{
+    uint64_t n = 0;
+    for (uint32_t node = 0; node <= MP_NUMA_NODES; ++node)
+        n += bytes[node] != 0;
+    return n;
+}
+
+static void
+mp_write_numa_bytes(int fd, const struct mp_numa *nm,
+                    const struct mp_dump_scratch *d)
+{
+    uint64_t n = 0;
+    for (size_t i = 0; i < d->n_sites; ++i)
+        n += mp_numa_row_count(nm->site_bytes[d->sites[i].site - nm->sites]);
+    mp_write_section(fd, MP_SECTION_NUMA_SITES,
+                     sizeof(struct mp_file_numa_bytes), n);
+    for (size_t i = 0; i < d->n_sites; ++i)
+        mp_write_numa_row(fd, (uint32_t)i,
+                          nm->site_bytes[d->sites[i].site - nm->sites]);
+
+    n = 0;
+    for (uint32_t node = 0; node < MP_NUMA_NODES; ++node)
+        n += mp_numa_row_count(nm->cpu_bytes[node]);
+    mp_write_section(fd, MP_SECTION_NUMA_CPUS,
+                     sizeof(struct mp_file_numa_bytes), n);
+    for (uint32_t node = 0; node < MP_NUMA_NODES; ++node)
+        mp_write_numa_row(fd, node, nm->cpu_bytes[node]);
+}
+
+static void
+mp_write_profile(const char *path, const struct mp_profile_view *v)
+{
+    struct mp_dump_scratch *d = mmap(NULL, sizeof *d, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (d == MAP_FAILED)
+        return;
+    mp_resolve_sites(v->sites, d);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC,
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        (void)munmap(d, sizeof *d);
+        return;
+    }
+
+    struct mp_file_header hdr;
+    memset(&hdr, 0, sizeof hdr);
+    hdr.magic         = MP_MAGIC;
+    hdr.version       = MP_VERSION;
+    hdr.header_size   = sizeof hdr;
+    hdr.stride_bytes  = v->stride;
+    hdr.alloc_count   = v->alloc_count;
+    hdr.sample_count  = v->sample_count;
+    hdr.site_overflow = v->site_overflow;
+    hdr.n_sites       = d->n_sites;
+    hdr.site_size     = sizeof(struct mp_file_site_disk);
+    uint64_t n_labels = mp_count_labels();
+    hdr.n_sections    = (v->stride_changes != 0) + (n_labels != 0)
+                        + (v->region != NULL) + (d->n_modules != 0)
+                        + (v->leaks != NULL) + (v->peak != NULL)
+                        + (v->growth != NULL) + (v->large != NULL)
+                        + (v->cold != NULL) + 2 * (v->fshare != NULL)
+                        + 3 * (v->numa != NULL) + (v->free_bins != NULL);
+    for (size_t i = 0; i < MP_SITE_CAP; ++i)
+        hdr.est_bytes += v->sites[i].est_bytes;
+    /* GLIBC_MALLOC_PROFILE_SEED promises identical files for identical
+       runs: leave out timings and absolute addresses.  */
+    if (!mp_seeded) {
+        hdr.slow_cycles   = v->overhead.slow_cycles;
+        hdr.unwind_cycles = v->overhead.unwind_cycles;
+        hdr.insert_cycles = v->overhead.insert_cycles;
+        hdr.dump_cycles   = __atomic_load_n(&mp_dump_cycles,
+                                            __ATOMIC_RELAXED);
+        hdr.cycle_hz      = MP_CYCLE_HZ;
+    }
+
+    (void)write(fd, &hdr, sizeof hdr);
+
+    for (size_t i = 0; i < d->n_sites; ++i) {
+        const struct mp_dump_site *ds = &d->sites[i];
+        const struct mp_site *s = ds->site;
+
+        struct mp_file_site_disk fs;
+        fs.pc           = mp_seeded ? 0 : (uint64_t)s->pc;
+        fs.sample_count = s->sample_count;
+        fs.total_bytes  = s->total_bytes;
+        fs.est_bytes    = s->est_bytes;
+        fs.label        = s->label;
+        fs.module       = ds->module;
+        fs.offset       = ds->offset;
+        fs.usable_bytes = s->usable_bytes;
+        memcpy(fs.hist, s->hist, sizeof fs.hist);
+        fs.realloc_old_bytes = s->realloc_old_bytes;
+        fs.realloc_copied    = s->realloc_copied;
+        memcpy(fs.realloc_count, s->realloc_count, sizeof fs.realloc_count);
+        fs.calloc_cleared    = s->calloc_cleared;
+        fs.calloc_count      = s->calloc_count;
+        fs.calloc_zeroed     = s->calloc_zeroed;
+        fs.resident_bytes    = s->resident_bytes;
+
+        (void)write(fd, &fs, sizeof fs);
+    }
+
+    if (v->stride_changes != 0) {
+        uint64_t n = v->stride_changes;
+        uint64_t kept = n < MP_STRIDE_LOG_CAP ? n : MP_STRIDE_LOG_CAP;
+        mp_write_section(fd, MP_SECTION_STRIDE_LOG,
+                         sizeof(struct mp_stride_change), kept);
+        for (uint64_t i = n - kept; i < n; ++i)
+            (void)write(fd, &v->stride_log[i % MP_STRIDE_LOG_CAP],
+                        sizeof(struct mp_stride_change));
+    }
+
+    if (n_labels != 0) {
+        mp_write_section(fd, MP_SECTION_LABELS,
+                         sizeof(struct mp_file_label), n_labels);
+        for (size_t i = 0; i < MP_LABEL_CAP; ++i) {
+            const struct mp_label *l = &mp_labels[i];
+            if (!__atomic_load_n(&l->ready, __ATOMIC_ACQUIRE))
+                continue;
+            struct mp_file_label fl;
+            fl.id       = (uint32_t)i + 1;
+            fl.reserved = 0;
+            memcpy(fl.key, l->key, sizeof fl.key);
+            memcpy(fl.value, l->value, sizeof fl.value);
+            (void)write(fd, &fl, sizeof fl);
+            if (--n_labels == 0)
+                break;
+        }
+    }
+
+    if (d->n_modules != 0) {
+        mp_write_section(fd, MP_SECTION_MODULES,
+                         sizeof(struct mp_file_module), d->n_modules);
+        for (size_t k = 0; k < d->n_modules; ++k) {
+            struct mp_file_module fm;
+            memset(&fm, 0, sizeof fm);
+            fm.id        = (uint32_t)k + 1;
+            fm.load_addr = mp_seeded ? 0 : d->modules[k]->l_addr;
+            strncpy(fm.path, mp_module_name(d->modules[k]),
+                    sizeof fm.path - 1);
+            (void)write(fd, &fm, sizeof fm);
+        }
+    }
+
+    if (v->region != NULL) {
+        struct mp_file_region fr;
+        memcpy(fr.name, v->region->name, sizeof fr.name);
+        fr.alloc_bytes = v->region->alloc_bytes;
+        mp_write_section(fd, MP_SECTION_REGION, sizeof fr, 1);
+        (void)write(fd, &fr, sizeof fr);
+    }
+
+    if (v->leaks != NULL) {
+        mp_write_section(fd, MP_SECTION_LEAKS, sizeof *v->leaks, 1);
+        (void)write(fd, v->leaks, sizeof *v->leaks);
+    }
+
+    if (v->peak != NULL) {
+        mp_write_section(fd, MP_SECTION_PEAK, sizeof *v->peak, 1);
+        (void)write(fd, v->peak, sizeof *v->peak);
+    }
+
+    if (v->growth != NULL) {
+        mp_write_section(fd, MP_SECTION_GROWTH, sizeof *v->growth, 1);
+        (void)write(fd, v->growth, sizeof *v->growth);
+    }
+
+    if (v->large != NULL) {
+        mp_write_section(fd, MP_SECTION_LARGE, sizeof *v->large, 1);
+        (void)write(fd, v->large, sizeof *v->large);
+    }
+
+    if (v->cold != NULL) {
+        mp_write_section(fd, MP_SECTION_COLD, sizeof *v->cold, 1);
+        (void)write(fd, v->cold, sizeof *v->cold);
+    }
+
+    if (v->fshare != NULL) {
+        mp_write_section(fd, MP_SECTION_FSHARE, sizeof *v->fshare, 1);
+        (void)write(fd, v->fshare, sizeof *v->fshare);
+        mp_write_fshare_pairs(fd, v->pairs, d);
+    }
+
+    if (v->numa != NULL) {
+        mp_write_section(fd, MP_SECTION_NUMA, sizeof *v->numa, 1);
+        (void)write(fd, v->numa, sizeof *v->numa);
+        mp_write_numa_bytes(fd, v->numa_bytes, d);
+    }
+
+    if (v->free_bins != NULL) {
+        mp_write_section(fd, MP_SECTION_FREE_BINS, sizeof *v->free_bins,
+                         v->n_free_bins);
+        (void)write(fd, v->free_bins, v->n_free_bins * sizeof *v->free_bins);
+    }
+
+    (void)close(fd);
+    (void)munmap(d, sizeof *d);
+}
+
+static void
+mp_thread_view(const struct mp_thread_rec *r, struct mp_profile_view *v)
+{
+    v->stride         = mp_sample_stride_bytes;
+    v->region         = NULL;
+    v->leaks          = NULL;
+    v->peak           = NULL;
+    v->growth         = NULL;
+    v->large          = NULL;
+    v->cold           = NULL;
+    v->fshare         = NULL;
+    v->pairs          = NULL;
+    v->numa           = NULL;
+    v->numa_bytes     = NULL;
+    v->free_bins      = NULL;
+    v->n_free_bins    = 0;
+    v->alloc_count    = r->alloc_count;
+    v->sample_count   = r->sample_count;
+    v->site_overflow  = r->site_overflow;
+    v->sites          = r->sites;
+    v->stride_changes = r->stride_changes;
+    v->stride_log     = r->stride_log;
+    v->overhead       = r->overhead;
+}
+
+/* Per-CPU tables are read in place; counts from threads still running
+   may be slightly behind.  */
+static void
+mp_cpu_view(const struct mp_cpu_table *t, struct mp_profile_view *v)
+{
+    v->stride         = mp_sample_stride_bytes;
+    v->region         = NULL;
+    v->leaks          = NULL;
+    v->peak           = NULL;
+    v->growth         = NULL;
+    v->large          = NULL;
+    v->cold           = NULL;
+    v->fshare         = NULL;
+    v->pairs          = NULL;
+    v->numa           = NULL;
+    v->numa_bytes     = NULL;
+    v->free_bins      = NULL;
+    v->n_free_bins    = 0;
+    v->alloc_count    = t->alloc_count;
+    v->sample_count   = t->sample_count;
+    v->site_overflow  = t->site_overflow;
+    v->sites          = t->sites;
+    v->stride_changes = t->stride_changes;
+    v->stride_log     = t->stride_log;
+    v->overhead       = t->overhead;
+}
+
+/* Regions are read in place like per-CPU tables.  Threads still inside
+   the region have not folded in their exact totals yet.  */
+static void
+mp_region_view(const struct mp_region *g, struct mp_profile_view *v)
+{
+    memset(v, 0, sizeof *v);
+    v->stride         = mp_region_stride_bytes;
+    v->region         = g;
+    v->alloc_count    = g->alloc_count;
+    v->sample_count   = g->sample_count;
+    v->site_overflow  = g->site_overflow;
+    v->sites          = g->sites;
+}
+
+
+/* ------------------------------------------------------
+ * Per-table output: human stats + binary snapshot
+ * ----------------------------------------------------*/
+
+/* Sum over every table reported so far, for the closing stats line.  */
+static struct {
+    uint64_t alloc_count;
+    uint64_t sample_count;
+    uint64_t tables;
+    struct mp_overhead overhead;
+} mp_totals;
+
+static void
+mp_totals_add(const struct mp_profile_view *v)
+{
+    /* Large allocations are in their threads' counts too.  */
+    if (v->large == NULL)
+        __atomic_fetch_add(&mp_totals.alloc_count, v->alloc_count,
+                           __ATOMIC_RELAXED);
+    __atomic_fetch_add(&mp_totals.sample_count, v->sample_count,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&mp_totals.tables, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&mp_totals.overhead.slow_cycles,
+                       v->overhead.slow_cycles, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&mp_totals.overhead.unwind_cycles,
+                       v->overhead.unwind_cycles, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&mp_totals.overhead.insert_cycles,
+                       v->overhead.insert_cycles, __ATOMIC_RELAXED);
+}
+
+/* ID of a table there is one of per process.  */
+#define MP_REPORT_SINGLE UINT64_MAX
+
+/* KIND is "thread", "cpu", "region", "large", "leaks", "peak", "growth",
+   "cold", "fshare", "numa" or "tcache"; ID names the table within the
+   process and becomes part of the dump file name.  */
+static void
+mp_report(const char *kind, uint64_t id, const struct mp_profile_view *v)
+{
+    if (v->alloc_count == 0 && v->sample_count == 0)
+        return;
+
+    char idstr[24] = "";
+    if (id != MP_REPORT_SINGLE)
+        snprintf(idstr, sizeof idstr, "%llu", (unsigned long long)id);
+
+    /* Binary profile dump. */
+    uint64_t dump_cycles = 0;
+    if (mp_out_base) {
+        char path[256];
+        int len = snprintf(path, sizeof path, "%s.%d.%s%s.bin",
+                           mp_out_base, (int)getpid(),
+                           strcmp(kind, "thread") == 0 ? "" : kind, idstr);
+        if (len > 0 && (size_t)len < sizeof path) {
+            uint64_t t0 = mp_cycles();
+            mp_write_profile(path, v);
+            dump_cycles = mp_cycles() - t0;
+            __atomic_fetch_add(&mp_dump_cycles, dump_cycles,
+                               __ATOMIC_RELAXED);
+        }
+    }
+
+    /* Region allocations and live sets are already counted by their
+       threads.  */
+    if (v->region == NULL && v->leaks == NULL && v->peak == NULL
+        && v->growth == NULL && v->cold == NULL && v->fshare == NULL
+        && v->numa == NULL && v->free_bins == NULL)
+        mp_totals_add(v);
+
+    /* Optional human-readable stats. */
     if (mp_stats_enabled) {
-        char buf[256];
+        char buf[384];
         int len = snprintf(buf, sizeof buf,
-                           "malloc-prof stats: thread=%p alloc_count=%llu "
-                           "sample_count=%llu stride=%llu site_overflow=%llu\n",
-                           (void *)st,
-                           (unsigned long long)st->alloc_count,
-                           (unsigned long long)st->sample_count,
-                           (unsigned long long)mp_sample_stride_bytes,
-                           (unsigned long long)st->site_overflow);
+                           "malloc-prof stats: %s=%s alloc_count=%llu "
+                           "sample_count=%llu stride=%llu site_overflow=%llu "
+                           "slow_cycles=%llu unwind_cycles=%llu "
+                           "insert_cycles=%llu dump_cycles=%llu\n",
+                           kind, idstr[0] ? idstr : "all",
+                           (unsigned long long)v->alloc_count,
+                           (unsigned long long)v->sample_count,
+                           (unsigned long long)v->stride,
+                           (unsigned long long)v->site_overflow,
+                           (unsigned long long)v->overhead.slow_cycles,
+                           (unsigned long long)v->overhead.unwind_cycles,
+                           (unsigned long long)v->overhead.insert_cycles,
+                           (unsigned long long)dump_cycles);
         if (len > 0)
             (void)write(STDERR_FILENO, buf, (size_t)len);
     }
+}
 
-    /* Binary profile dump. */
-    if (mp_out_base)
-        mp_dump_thread_to_file(st);
-}
\ No newline at end of file
+static void
+mp_report_totals(void)
+{
+    if (!mp_stats_enabled || mp_totals.tables == 0)
+        return;
+
+    char buf[384];
+    int len = snprintf(buf, sizeof buf,
+                       "malloc-prof stats: total tables=%llu "
+                       "alloc_count=%llu sample_count=%llu "
+                       "slow_cycles=%llu unwind_cycles=%llu "
+                       "insert_cycles=%llu dump_cycles=%llu cycle_hz=%llu\n",
+                       (unsigned long long)mp_totals.tables,
+                       (unsigned long long)mp_totals.alloc_count,
+                       (unsigned long long)mp_totals.sample_count,
+                       (unsigned long long)mp_totals.overhead.slow_cycles,
+                       (unsigned long long)mp_totals.overhead.unwind_cycles,
+                       (unsigned long long)mp_totals.overhead.insert_cycles,
+                       (unsigned long long)mp_dump_cycles,
+                       (unsigned long long)MP_CYCLE_HZ);
+    if (len > 0)
+        (void)write(STDERR_FILENO, buf, (size_t)len);
+}
+
+static void
+mp_report_thread(const struct mp_thread_rec *r)
+{
+    struct mp_profile_view v;
+    mp_thread_view(r, &v);
+    mp_report("thread", r->thread_index, &v);
+}
+
+static void
+mp_report_cpus(void)
+{
+    struct mp_cpu_table *t;
+    if (__mp_tls_state.alloc_count != 0
+        && (t = mp_cpu_table_self()) != NULL)
+        mp_cpu_flush_alloc_count(&__mp_tls_state, t);
+
+    t = __atomic_load_n(&mp_cpu_tables, __ATOMIC_ACQUIRE);
+    if (t == NULL)
+        return;
+    for (unsigned int cpu = 0; cpu < mp_ncpus; ++cpu) {
+        struct mp_profile_view v;
+        mp_cpu_view(&t[cpu], &v);
+        mp_report("cpu", cpu, &v);
+    }
+}
+
+static void
+mp_report_regions(void)
+{
+    struct mp_region *tab = __atomic_load_n(&mp_regions, __ATOMIC_ACQUIRE);
+    if (tab == NULL)
+        return;
+    for (unsigned int i = 0; i < MP_REGION_CAP; ++i) {
+        if (!__atomic_load_n(&tab[i].ready, __ATOMIC_ACQUIRE))
+            break;
+        struct mp_profile_view v;
+        mp_region_view(&tab[i], &v);
+        mp_report("region", i + 1, &v);
+    }
+}
+
+/* Large allocations, as a profile of their own.  */
+static void
+mp_report_large(void)
+{
+    struct mp_large_table *t = __atomic_load_n(&mp_large, __ATOMIC_ACQUIRE);
+    if (t == NULL)
+        return;
+
+    struct mp_file_large fl;
+    fl.threshold   = __mp_large_bytes;
+    fl.alloc_bytes = __atomic_load_n(&t->alloc_bytes, __ATOMIC_RELAXED);
+
+    struct mp_profile_view v;
+    memset(&v, 0, sizeof v);
+    v.stride        = 1;
+    v.large         = &fl;
+    v.alloc_count   = __atomic_load_n(&t->alloc_count, __ATOMIC_RELAXED);
+    v.sample_count  = v.alloc_count;
+    v.site_overflow = t->site_overflow;
+    v.sites         = t->sites;
+    mp_report("large", MP_REPORT_SINGLE, &v);
+}
+
+/* Group the allocations still in the live table by site.  Nothing is
+   known about reachability: an allocation a global still points to
+   counts as outstanding like a lost one.  */
+static void
+mp_report_leaks(void)
+{
+    struct mp_live_table *t = __atomic_load_n(&mp_live, __ATOMIC_ACQUIRE);
+    if (t == NULL)
+        return;
+
+    struct mp_site *sites = mmap(NULL, MP_SITE_CAP * sizeof *sites,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (sites == MAP_FAILED)
+        return;
+
+    struct mp_file_leaks leaks;
+    uint64_t site_overflow = 0;
+    leaks.untracked = __atomic_load_n(&t->untracked, __ATOMIC_RELAXED);
+    leaks.outstanding = mp_live_aggregate(t, sites, &site_overflow, 1);
+
+    struct mp_profile_view v;
+    memset(&v, 0, sizeof v);
+    v.stride        = mp_sample_stride_bytes;
+    v.leaks         = &leaks;
+    v.sample_count  = leaks.outstanding;
+    v.site_overflow = site_overflow;
+    v.sites         = sites;
+    mp_report("leaks", MP_REPORT_SINGLE, &v);
+
+    (void)munmap(sites, MP_SITE_CAP * sizeof *sites);
+}
+
+/* Cold allocations at exit, after a last scan.  */
+static void
+mp_report_cold(void)
+{
+    struct mp_live_table *t = __atomic_load_n(&mp_live, __ATOMIC_ACQUIRE);
+    if (mp_cold_min == 0 || t == NULL)
+        return;
+
+    while (__atomic_exchange_n(&mp_cold_lock, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+    mp_cold_scan();
+    __atomic_store_n(&mp_cold_lock, 0, __ATOMIC_RELEASE);
+    if (mp_cold_state < 0) {
+        static const char msg[] =
+            "malloc-prof stats: cold=unavailable (no soft-dirty support)\n";
+        if (mp_stats_enabled)
+            (void)write(STDERR_FILENO, msg, sizeof msg - 1);
+        return;
+    }
+
+    struct mp_site *sites = mmap(NULL, MP_SITE_CAP * sizeof *sites,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (sites == MAP_FAILED)
+        return;
+
+    struct mp_file_cold cold;
+    memset(&cold, 0, sizeof cold);
+    cold.min_size = mp_cold_min;
+    cold.age_ns   = mp_cold_age_ns;
+    cold.scans    = mp_cold_scans;
+
+    uint32_t epoch = __atomic_load_n(&mp_cold_epoch, __ATOMIC_RELAXED);
+    uint64_t n_cold = 0, site_overflow = 0;
+    for (size_t i = 0; i < MP_LIVE_CAP; ++i) {
+        const struct mp_live *e = &t->entries[i];
+        if (__atomic_load_n(&e->ptr, __ATOMIC_ACQUIRE) <= MP_LIVE_BUSY
+            || e->usable < mp_cold_min || epoch - e->born < MP_COLD_SCANS)
+            continue;
+        cold.aged++;
+        cold.aged_bytes += e->est;
+        if (e->written - e->born >= MP_COLD_SCANS)
+            continue;
+        struct mp_sample smp;
+        memset(&smp, 0, sizeof smp);
+        smp.pc     = e->pc;
+        smp.label  = e->label;
+        smp.size   = e->size;
+        smp.usable = e->usable;
+        smp.est    = e->est;
+        smp.realloc_kind = -1;
+        smp.resident = mp_live_resident(e);
+        n_cold++;
+        mp_shared_record_site(sites, &site_overflow, &smp);
+    }
+
+    struct mp_profile_view v;
+    memset(&v, 0, sizeof v);
+    v.stride        = mp_sample_stride_bytes;
+    v.cold          = &cold;
+    v.sample_count  = n_cold;
+    v.site_overflow = site_overflow;
+    v.sites         = sites;
+    mp_report("cold", MP_REPORT_SINGLE, &v);
+
+    (void)munmap(sites, MP_SITE_CAP * sizeof *sites);
+}
+
+/* Live sampled allocations by NUMA node at exit.  */
+static void
+mp_report_numa(void)
+{
+    struct mp_live_table *t = __atomic_load_n(&mp_live, __ATOMIC_ACQUIRE);
+    if (!mp_numa_enabled || t == NULL)
+        return;
+
+    struct mp_numa *nm = mmap(NULL, sizeof *nm, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (nm == MAP_FAILED)
+        return;
+
+    uint64_t n = 0;
+    for (size_t i = 0; i < MP_LIVE_CAP; ++i) {
+        const struct mp_live *e = &t->entries[i];
+        if (__atomic_load_n(&e->ptr, __ATOMIC_ACQUIRE) <= MP_LIVE_BUSY)
+            continue;
+        struct mp_sample smp;
+        memset(&smp, 0, sizeof smp);
+        smp.pc     = e->pc;
+        smp.label  = e->label;
+        smp.size   = e->size;
+        smp.usable = e->usable;
+        smp.est    = e->est;
+        smp.realloc_kind = -1;
+        smp.resident = mp_live_resident(e);
+        n++;
+        mp_shared_record_site(nm->sites, &nm->site_overflow, &smp);
+
+        uint64_t bytes[MP_NUMA_NODES + 1] = { 0 };
+        mp_numa_pages(nm, e, bytes);
+        ssize_t slot = mp_site_slot(nm->sites, e->pc, e->label);
+        for (uint32_t node = 0; node <= MP_NUMA_NODES; ++node) {
+            if (slot >= 0)
+                nm->site_bytes[slot][node] += bytes[node];
+            if (e->node < MP_NUMA_NODES)
+                nm->cpu_bytes[e->node][node] += bytes[node];
+        }
+    }
+
+    struct mp_file_numa fn;
+    fn.nodes       = nm->single_node || nm->nodes == 0 ? 1 : nm->nodes;
+    fn.single_node = nm->single_node;
+    fn.other_bytes = nm->other_bytes;
+
+    struct mp_profile_view v;
+    memset(&v, 0, sizeof v);
+    v.stride        = mp_sample_stride_bytes;
+    v.numa          = &fn;
+    v.numa_bytes    = nm;
+    v.sample_count  = n;
+    v.site_overflow = nm->site_overflow;
+    v.sites         = nm->sites;
+    mp_report("numa", MP_REPORT_SINGLE, &v);
+
+    (void)munmap(nm, sizeof *nm);
+}
+
+/* Free chunks in thread caches and arena bins at exit, without sites.
+   Threads still running keep using their caches while they are read.  */
+#define MP_FREE_BIN_CAP (1U << 16)
+
+static void
+mp_report_tcache(void)
+{
+    if (!mp_tcache_enabled)
+        return;
+#ifdef MPROF_SHIM
+    static const char msg[] =
+        "malloc-prof stats: tcache=unavailable (LD_PRELOAD build)\n";
+    if (mp_stats_enabled)
+        (void)write(STDERR_FILENO, msg, sizeof msg - 1);
+#else
+    size_t len = MP_FREE_BIN_CAP * sizeof(struct mp_free_bin)
+                 + MP_SITE_CAP * sizeof(struct mp_site);
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return;
+    struct mp_free_bin *bins = p;
+    struct mp_site *no_sites = (struct mp_site *)(bins + MP_FREE_BIN_CAP);
+
+    struct mp_profile_view v;
+    memset(&v, 0, sizeof v);
+    v.stride       = mp_sample_stride_bytes;
+    v.free_bins    = bins;
+    v.n_free_bins  = mp_tcache_collect(bins, MP_FREE_BIN_CAP);
+    v.sample_count = v.n_free_bins;
+    v.sites        = no_sites;
+    mp_report("tcache", MP_REPORT_SINGLE, &v);
+
+    if (mp_stats_enabled) {
+        uint64_t cached = 0, binned = 0;
+        for (uint64_t i = 0; i < v.n_free_bins; ++i) {
+            if (bins[i].kind == MP_FREE_TCACHE)
+                cached += bins[i].bytes;
+            else
+                binned += bins[i].bytes;
+        }
+        char buf[128];
+        int n = snprintf(buf, sizeof buf,
+                         "malloc-prof stats: tcache_bytes=%llu "
+                         "arena_free_bytes=%llu\n",
+                         (unsigned long long)cached,
+                         (unsigned long long)binned);
+        if (n > 0)
+            (void)write(STDERR_FILENO, buf, (size_t)n);
+    }
+
+    (void)munmap(p, len);
+#endif
+}
+
+/* Sites sharing cache lines across threads.  */
+static void
+mp_report_fshare(void)
+{
+    struct mp_fshare *fs = __atomic_load_n(&mp_fshare, __ATOMIC_ACQUIRE);
+    if (fs == NULL)
+        return;
+
+    while (__atomic_exchange_n(&mp_fshare_lock, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+
+    struct mp_file_fshare ff;
+    ff.line_size     = MP_LINE_SIZE;
+    ff.max_size      = mp_fshare_max;
+    ff.events        = fs->events;
+    ff.pair_overflow = fs->pair_overflow;
+
+    struct mp_profile_view v;
+    memset(&v, 0, sizeof v);
+    v.stride        = mp_sample_stride_bytes;
+    v.fshare        = &ff;
+    v.pairs         = fs->pairs;
+    v.sample_count  = fs->events;
+    v.site_overflow = fs->site_overflow;
+    v.sites         = fs->sites;
+    mp_report("fshare", MP_REPORT_SINGLE, &v);
+
+    __atomic_store_n(&mp_fshare_lock, 0, __ATOMIC_RELEASE);
+}
+
+/* The largest live set captured, as a profile of its own.  */
+static void
+mp_report_peak(void)
+{
+    while (__atomic_exchange_n(&mp_peak_lock, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+
+    struct mp_peak *pk = mp_peak;
+    if (pk != NULL) {
+        struct mp_file_peak fp;
+        fp.live_bytes = pk->live_bytes;
+        fp.captures   = pk->captures;
+
+        struct mp_profile_view v;
+        memset(&v, 0, sizeof v);
+        v.stride        = mp_sample_stride_bytes;
+        v.peak          = &fp;
+        v.sample_count  = pk->outstanding;
+        v.site_overflow = pk->site_overflow;
+        v.sites         = pk->sites;
+        mp_report("peak", MP_REPORT_SINGLE, &v);
+    }
+
+    __atomic_store_n(&mp_peak_lock, 0, __ATOMIC_RELEASE);
+}
+
+/* A growth snapshot is captured by the sample that notices the growth,
+   but writing it there would put open, write and close on an allocating
+   call.  Captures wait here for the next thread exit, malloc_info call
+   or the exit-time dump (mp_write_growth).  Past MP_GROWTH_QUEUE_MAX
+   waiting snapshots further growth is skipped and only counted.  */
+#define MP_GROWTH_QUEUE_MAX 64
+
+struct mp_growth_snap {
+    struct mp_growth_snap *next;
+    struct mp_file_growth fg;
+    uint64_t sample_count;
+    uint64_t site_overflow;
+    struct mp_site sites[MP_SITE_CAP];
+};
+
+static struct mp_growth_snap *mp_growth_queue;
+static uint64_t mp_growth_queued;   /* captured, not yet written */
+static uint64_t mp_growth_dropped;  /* skipped with the queue full */
+
+/* Capture the snapshot noted by __mp_on_heap_grow, if still pending.  */
+static void
+mp_capture_growth(void)
+{
+    uint64_t heap = __atomic_exchange_n(&mp_growth_pending, 0,
+                                        __ATOMIC_ACQUIRE);
+    struct mp_live_table *t = __atomic_load_n(&mp_live, __ATOMIC_ACQUIRE);
+    if (heap == 0 || t == NULL)
+        return;
+
+    if (__atomic_add_fetch(&mp_growth_queued, 1, __ATOMIC_RELAXED)
+        > MP_GROWTH_QUEUE_MAX) {
+        __atomic_fetch_sub(&mp_growth_queued, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&mp_growth_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    struct mp_growth_snap *g = mmap(NULL, sizeof *g, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (g == MAP_FAILED) {
+        __atomic_fetch_sub(&mp_growth_queued, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    /* Keep the numbering free of gaps: nothing live, nothing written.  */
+    g->sample_count = mp_live_aggregate(t, g->sites, &g->site_overflow, 0);
+    if (g->sample_count == 0) {
+        (void)munmap(g, sizeof *g);
+        __atomic_fetch_sub(&mp_growth_queued, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    g->fg.seq             = __atomic_add_fetch(&mp_growth_seq, 1,
+                                               __ATOMIC_RELAXED);
+    g->fg.heap_bytes      = heap;
+    g->fg.prev_heap_bytes = __atomic_exchange_n(&mp_growth_base, heap,
+                                                __ATOMIC_RELAXED);
+
+    g->next = __atomic_load_n(&mp_growth_queue, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&mp_growth_queue, &g->next, g, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Write and release every captured growth snapshot.  Never called from
+   inside an allocation.  */
+static void
+mp_write_growth(void)
+{
+    struct mp_growth_snap *g = __atomic_exchange_n(&mp_growth_queue, NULL,
+                                                   __ATOMIC_ACQUIRE);
+    while (g != NULL) {
+        struct mp_growth_snap *next = g->next;
+
+        struct mp_profile_view v;
+        memset(&v, 0, sizeof v);
+        v.stride        = mp_sample_stride_bytes;
+        v.sample_count  = g->sample_count;
+        v.site_overflow = g->site_overflow;
+        v.sites         = g->sites;
+        v.growth        = &g->fg;
+        mp_report("growth", g->fg.seq, &v);
+
+        (void)munmap(g, sizeof *g);
+        __atomic_fetch_sub(&mp_growth_queued, 1, __ATOMIC_RELAXED);
+        g = next;
+    }
+
+    uint64_t dropped = __atomic_exchange_n(&mp_growth_dropped, 0,
+                                           __ATOMIC_RELAXED);
+    if (dropped != 0 && mp_stats_enabled) {
+        char buf[96];
+        int len = snprintf(buf, sizeof buf,
+                           "malloc-prof stats: growth snapshots skipped=%llu "
+                           "(queue full)\n", (unsigned long long)dropped);
+        if (len > 0)
+            (void)write(STDERR_FILENO, buf, (size_t)len);
+    }
+}
+
+/* Make sure the calling thread owns a record carrying its current
+   counters, even if it never took a sample.  */
+static struct mp_thread_rec *
+mp_publish_self(void)
+{
+    struct __mp_tls *st = &__mp_tls_state;
+
+    if (st->alloc_count == 0)
+        return st->rec;
+    if (st->rec == NULL && (st->rec = mp_registry_join()) == NULL)
+        return NULL;
+
+    mp_rec_write_begin(st->rec);
+    st->rec->alloc_count = st->alloc_count;
+    mp_rec_write_end(st->rec);
+    return st->rec;
+}
+
+
+/* ------------------------------------------------------
+ * malloc_info section
+ * ----------------------------------------------------*/
+
+#ifndef MPROF_SHIM
+/* Sites of every running thread's table (or every CPU's), merged by
+   (pc, label).  Exited threads' sites went to their dump files; their
+   counts are in mp_totals.  */
+struct mp_info_site {
+    uintptr_t pc;
+    uint32_t label;
+    uint64_t samples;
+    uint64_t bytes;
+    uint64_t est_bytes;
+};
+
+struct mp_info_scratch {
+    struct mp_thread_rec rec;               /* snapshot being merged */
+    struct mp_info_site sites[MP_INFO_MERGE_CAP];
+    uint64_t alloc_count;
+    uint64_t sample_count;
+    uint64_t site_overflow;                 /* samples not in a table */
+    uint64_t merge_overflow;                /* sites not merged */
+    uint64_t snapshot_failures;             /* tables not read */
+    uint64_t tables;
+    struct mp_overhead overhead;
+};
+
+static void
+mp_info_merge(struct mp_info_scratch *x, const struct mp_site *sites)
+{
+    size_t cap = MP_INFO_MERGE_CAP;
+    for (size_t i = 0; i < MP_SITE_CAP; ++i) {
+        const struct mp_site *s = &sites[i];
+        uintptr_t pc = __atomic_load_n(&s->pc, __ATOMIC_ACQUIRE);
+        if (pc <= MP_SITE_BUSY)
+            continue;
+
+        size_t idx = mp_hash_site(pc, s->label) % cap;
+        size_t probe;
+        for (probe = 0; probe < cap; ++probe) {
+            struct mp_info_site *m = &x->sites[idx];
+            if (m->pc == 0) {
+                m->pc = pc;
+                m->label = s->label;
+            }
+            if (m->pc == pc && m->label == s->label) {
+                m->samples   += __atomic_load_n(&s->sample_count,
+                                                __ATOMIC_RELAXED);
+                m->bytes     += __atomic_load_n(&s->total_bytes,
+                                                __ATOMIC_RELAXED);
+                m->est_bytes += __atomic_load_n(&s->est_bytes,
+                                                __ATOMIC_RELAXED);
+                break;
+            }
+            idx = (idx + 1) % cap;
+        }
+        if (probe == cap)
+            x->merge_overflow++;
+    }
+}
+
+static void
+mp_info_add_table(struct mp_info_scratch *x, uint64_t alloc_count,
+                  uint64_t sample_count, uint64_t site_overflow,
+                  const struct mp_overhead *o, const struct mp_site *sites)
+{
+    x->alloc_count   += alloc_count;
+    x->sample_count  += sample_count;
+    x->site_overflow += site_overflow;
+    x->overhead.slow_cycles   += o->slow_cycles;
+    x->overhead.unwind_cycles += o->unwind_cycles;
+    x->overhead.insert_cycles += o->insert_cycles;
+    x->tables++;
+    mp_info_merge(x, sites);
+}
+
+/* Write S quoted for an XML attribute or a JSON string.  */
+static void
+mp_info_string(FILE *fp, const char *s, int json)
+{
+    putc('"', fp);
+    for (; *s != '\0'; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (json && (c == '"' || c == '\\'))
+            fprintf(fp, "\\%c", c);
+        else if (json && c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else if (!json && c == '"')
+            fputs("&quot;", fp);
+        else if (!json && c == '&')
+            fputs("&amp;", fp);
+        else if (!json && c == '<')
+            fputs("&lt;", fp);
+        else if (!json && c == '>')
+            fputs("&gt;", fp);
+        else
+            putc(c, fp);
+    }
+    putc('"', fp);
+}
+
+static void
+mp_info_write_site(FILE *fp, const struct mp_info_site *m, int json,
+                   int first)
+{
+    struct dl_find_object obj;
+    const char *module = NULL;
+    uintptr_t offset = m->pc;
+    if (_dl_find_object((void *)m->pc, &obj) == 0) {
+        module = mp_module_name(obj.dlfo_link_map);
+        offset = m->pc - obj.dlfo_link_map->l_addr;
+    }
+
+    fputs(json ? (first ? "{" : ",{") : "<site", fp);
+    if (module != NULL) {
+        fputs(json ? "\"module\":" : " module=", fp);
+        mp_info_string(fp, module, json);
+        fprintf(fp, json ? ",\"offset\":%llu" : " offset=\"0x%llx\"",
+                (unsigned long long)offset);
+    } else {
+        fprintf(fp, json ? "\"pc\":%llu" : " pc=\"0x%llx\"",
+                (unsigned long long)offset);
+    }
+
+    struct mp_label *tab = __atomic_load_n(&mp_labels, __ATOMIC_ACQUIRE);
+    if (m->label != 0 && tab != NULL && m->label <= MP_LABEL_CAP
+        && __atomic_load_n(&tab[m->label - 1].ready, __ATOMIC_ACQUIRE)) {
+        fputs(json ? ",\"label_key\":" : " label_key=", fp);
+        mp_info_string(fp, tab[m->label - 1].key, json);
+        fputs(json ? ",\"label_value\":" : " label_value=", fp);
+        mp_info_string(fp, tab[m->label - 1].value, json);
+    }
+
+    fprintf(fp, json
+            ? ",\"samples\":%llu,\"bytes\":%llu,\"est_bytes\":%llu}"
+            : " samples=\"%llu\" bytes=\"%llu\" est_bytes=\"%llu\"/>\n",
+            (unsigned long long)m->samples, (unsigned long long)m->bytes,
+            (unsigned long long)m->est_bytes);
+}
+
+/* Called by malloc_info, which holds no arena lock by then.  Tables are
+   read like a signal-time dump would: thread records through their
+   seqlock, per-CPU tables in place.  */
+void
+__mp_info(FILE *fp, int json)
+{
+    mp_global_init_if_needed();
+    if (!mp_global_enabled)
+        return;
+
+    mp_write_growth();
+
+    struct mp_info_scratch *x = mmap(NULL, sizeof *x, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (x == MAP_FAILED)
+        return;
+
+    mp_publish_self();
+    if (mp_percpu_enabled) {
+        struct mp_cpu_table *t = __atomic_load_n(&mp_cpu_tables,
+                                                 __ATOMIC_ACQUIRE);
+        for (unsigned int cpu = 0; t != NULL && cpu < mp_ncpus; ++cpu)
+            mp_info_add_table(x, t[cpu].alloc_count, t[cpu].sample_count,
+                              t[cpu].site_overflow, &t[cpu].overhead,
+                              t[cpu].sites);
+    } else {
+        for (struct mp_thread_rec *r = __mp_registry_first(); r != NULL;
+             r = r->next) {
+            if (!__atomic_load_n(&r->in_use, __ATOMIC_ACQUIRE))
+                continue;
+            if (__mp_rec_snapshot(r, &x->rec) != 0) {
+                x->snapshot_failures++;
+                continue;
+            }
+            mp_info_add_table(x, x->rec.alloc_count, x->rec.sample_count,
+                              x->rec.site_overflow, &x->rec.overhead,
+                              x->rec.sites);
+        }
+    }
+    /* Tables already reported, i.e. of threads that have exited.  */
+    x->alloc_count  += mp_totals.alloc_count;
+    x->sample_count += mp_totals.sample_count;
+    x->tables       += mp_totals.tables;
+    x->overhead.slow_cycles   += mp_totals.overhead.slow_cycles;
+    x->overhead.unwind_cycles += mp_totals.overhead.unwind_cycles;
+    x->overhead.insert_cycles += mp_totals.overhead.insert_cycles;
+
+    uint64_t live_untracked = 0;
+    struct mp_live_table *lt = __atomic_load_n(&mp_live, __ATOMIC_ACQUIRE);
+    if (lt != NULL)
+        live_untracked = __atomic_load_n(&lt->untracked, __ATOMIC_RELAXED);
+
+    if (json)
+        fprintf(fp, ",\"profiler\":{\"stride\":%llu,\"max_sps\":%llu,"
+                "\"alloc_count\":%llu,\"sample_count\":%llu,"
+                "\"tables\":%llu,"
+                "\"overflow\":{\"sites\":%llu,\"merge\":%llu,"
+                "\"snapshots\":%llu,\"live\":%llu},"
+                "\"overhead\":{\"slow_cycles\":%llu,\"unwind_cycles\":%llu,"
+                "\"insert_cycles\":%llu,\"dump_cycles\":%llu,"
+                "\"cycle_hz\":%llu},\"sites\":[",
+                (unsigned long long)mp_sample_stride_bytes,
+                (unsigned long long)mp_max_sps,
+                (unsigned long long)x->alloc_count,
+                (unsigned long long)x->sample_count,
+                (unsigned long long)x->tables,
+                (unsigned long long)x->site_overflow,
+                (unsigned long long)x->merge_overflow,
+                (unsigned long long)x->snapshot_failures,
+                (unsigned long long)live_untracked,
+                (unsigned long long)x->overhead.slow_cycles,
+                (unsigned long long)x->overhead.unwind_cycles,
+                (unsigned long long)x->overhead.insert_cycles,
+                (unsigned long long)mp_dump_cycles,
+                (unsigned long long)MP_CYCLE_HZ);
+    else
+        fprintf(fp, "<profiler>\n"
+                "<stride bytes=\"%llu\" max_sps=\"%llu\"/>\n"
+                "<samples alloc_count=\"%llu\" sample_count=\"%llu\" "
+                "tables=\"%llu\"/>\n"
+                "<overflow sites=\"%llu\" merge=\"%llu\" snapshots=\"%llu\" "
+                "live=\"%llu\"/>\n"
+                "<overhead slow_cycles=\"%llu\" unwind_cycles=\"%llu\" "
+                "insert_cycles=\"%llu\" dump_cycles=\"%llu\" "
+                "cycle_hz=\"%llu\"/>\n"
+                "<sites>\n",
+                (unsigned long long)mp_sample_stride_bytes,
+                (unsigned long long)mp_max_sps,
+                (unsigned long long)x->alloc_count,
+                (unsigned long long)x->sample_count,
+                (unsigned long long)x->tables,
+                (unsigned long long)x->site_overflow,
+                (unsigned long long)x->merge_overflow,
+                (unsigned long long)x->snapshot_failures,
+                (unsigned long long)live_untracked,
+                (unsigned long long)x->overhead.slow_cycles,
+                (unsigned long long)x->overhead.unwind_cycles,
+                (unsigned long long)x->overhead.insert_cycles,
+                (unsigned long long)mp_dump_cycles,
+                (unsigned long long)MP_CYCLE_HZ);
+
+    /* Top sites by estimated bytes, by repeated selection: N is small.  */
+    size_t cap = MP_INFO_MERGE_CAP;
+    for (uint64_t k = 0; k < mp_info_sites; ++k) {
+        struct mp_info_site *best = NULL;
+        for (size_t i = 0; i < cap; ++i)
+            if (x->sites[i].pc != 0
+                && (best == NULL || x->sites[i].est_bytes > best->est_bytes))
+                best = &x->sites[i];
+        if (best == NULL)
+            break;
+        mp_info_write_site(fp, best, json, k == 0);
+        best->pc = 0;
+    }
+
+    fputs(json ? "]}" : "</sites>\n</profiler>\n", fp);
+    (void)munmap(x, sizeof *x);
+}
+#endif
+
+
+/* ------------------------------------------------------
+ * Thread exit and fork
+ * ----------------------------------------------------*/
+
+void
+__mp_on_thread_exit(void)
+{
+    if (mp_global_enabled != 1)
+        return;
+
+    struct __mp_tls *st = &__mp_tls_state;
+
+    mp_write_growth();
+    if (st->region != 0)
+        mp_region_leave(st);
+    if (mp_peak_margin != 0)
+        mp_peak_flush(st);
+
+    if (mp_percpu_enabled) {
+        struct mp_cpu_table *t;
+        if (st->alloc_count != 0 && (t = mp_cpu_table_self()) != NULL)
+            mp_cpu_flush_alloc_count(st, t);
+        st->bytes_until_sample = UINT64_MAX;
+        return;
+    }
+
+    struct mp_thread_rec *r = mp_publish_self();
+    if (r == NULL)
+        return;
+
+    mp_report_thread(r);
+
+    /* Allocations made later in thread teardown must not rejoin the
+       registry: push the next sample out of reach.  */
+    st->rec = NULL;
+    st->bytes_until_sample = UINT64_MAX;
+    mp_registry_leave(r);
+}
+
+void
+__mp_on_fork_child(void)
+{
+    struct mp_thread_rec *self = __mp_tls_state.rec;
+
+    for (struct mp_thread_rec *r = __mp_registry_first(); r; r = r->next) {
+        if (r == self)
+            continue;
+        /* The owner may have been mid-update when fork was called; it no
+           longer exists to close the write.  */
+        if (r->seq & 1)
+            r->seq++;
+        mp_registry_leave(r);
+    }
+
+    /* The pagemap and clear_refs descriptors belong to the parent, and
+       the locks may have been held by threads that are gone.  */
+    if (mp_cold_state > 0)
+        mp_cold_close();
+    mp_cold_state = 0;
+    mp_cold_lock = 0;
+    mp_fshare_lock = 0;
+    mp_label_lock = 0;
+    mp_region_lock = 0;
+    mp_peak_lock = 0;
+
+    /* Growth snapshots captured by the parent are the parent's to write.  */
+    for (struct mp_growth_snap *g = mp_growth_queue, *next; g; g = next) {
+        next = g->next;
+        (void)munmap(g, sizeof *g);
+    }
+    mp_growth_queue = NULL;
+    mp_growth_queued = 0;
+    mp_growth_dropped = 0;
+
+    /* Only this thread's cache survives; it has a new TID.  */
+    struct mp_tcache_slot *mine = __mp_tls_state.tcache_slot;
+    for (struct mp_tcache_slot *s = mp_tcache_head; s; s = s->next) {
+        s->readers = 0;
+        if (s == mine) {
+            s->tid = gettid();
+        } else if (s->in_use) {
+            s->tcache = NULL;
+            s->in_use = 0;
+        }
+    }
+}
+
+
+/* ------------------------------------------------------
+ * Destructor: dump stats + binary snapshot of every live thread
+ * ----------------------------------------------------*/
+
+static void __attribute__((destructor))
+__mp_dump_stats_destructor(void)
+{
+    if (mp_global_enabled != 1)
+        return;
+
+    mp_write_growth();
+    if (__mp_tls_state.region != 0)
+        mp_region_leave(&__mp_tls_state);
+    mp_report_regions();
+
+    if (mp_percpu_enabled) {
+        mp_report_cpus();
+        mp_report_large();
+        mp_report_cold();
+        mp_report_fshare();
+        mp_report_numa();
+        mp_report_tcache();
+        mp_report_leaks();
+        mp_report_peak();
+        mp_report_totals();
+        return;
+    }
+
+    struct mp_thread_rec *self = mp_publish_self();
+    if (self != NULL)
+        mp_report_thread(self);
+
+    /* Other threads may still be running; copy their records out under
+       the seqlock rather than reading them in place.  */
+    struct mp_thread_rec *copy = NULL;
+    for (struct mp_thread_rec *r = __mp_registry_first(); r; r = r->next) {
+        if (r == self || __atomic_load_n(&r->in_use, __ATOMIC_ACQUIRE) == 0)
+            continue;
+        if (copy == NULL) {
+            void *p = mmap(NULL, sizeof *copy, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED)
+                break;
+            copy = p;
+        }
+        if (__mp_rec_snapshot(r, copy) == 0)
+            mp_report_thread(copy);
+    }
+    if (copy != NULL)
+        (void)munmap(copy, sizeof *copy);
+
+    mp_report_large();
+    mp_report_cold();
+    mp_report_fshare();
+    mp_report_numa();
+    mp_report_tcache();
+    mp_report_leaks();
+    mp_report_peak();
+    mp_report_totals();
+}
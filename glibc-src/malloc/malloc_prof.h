@@ -3,29 +3,322 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+
+/* Request-size histogram of a site's samples: 16-byte classes below
+   128 bytes, then one bucket per power of two from 128 bytes up; the
+   last bucket (1 GB) is open-ended.  Counts are sampled allocations;
+   since sampling is by bytes, for sizes below the stride they are
+   proportional to the bytes requested at each size.  */
+#define MP_HIST_BUCKETS 32
+
+/* How a sampled realloc resized the old block (enum mprof_realloc_kind
+   in malloc.c).  */
+#define MP_REALLOC_NEW      0    /* realloc(NULL, n) */
+#define MP_REALLOC_IN_PLACE 1    /* same address, nothing copied */
+#define MP_REALLOC_MREMAP   2    /* mmapped chunk moved or grown by mremap */
+#define MP_REALLOC_COPY     3    /* new chunk, old contents copied */
+#define MP_REALLOC_KINDS    4
 
 struct mp_site {
     uintptr_t pc;          /* call site (return address) */
+    uint32_t  label;       /* malloc_profile_label id, 0 = none */
     uint64_t  sample_count;
     uint64_t  total_bytes;
+    uint64_t  est_bytes;   /* sum of samples x stride in effect */
+    uint64_t  usable_bytes;           /* sum of usable sizes: slack is
+                                         usable_bytes - total_bytes */
+    uint32_t  hist[MP_HIST_BUCKETS];  /* samples by request size */
+
+    /* Realloc samples only; their new sizes are in the fields above.  */
+    uint64_t  realloc_old_bytes;      /* sum of old usable sizes */
+    uint64_t  realloc_copied;         /* sum of bytes copied */
+    uint32_t  realloc_count[MP_REALLOC_KINDS];  /* samples by outcome */
+
+    /* Calloc samples only.  */
+    uint64_t  calloc_cleared;         /* sum of bytes zeroed */
+    uint32_t  calloc_count;
+    uint32_t  calloc_zeroed;          /* samples that had to zero memory */
+
+    /* Live-set dumps only: est_bytes scaled by the resident share of
+       each allocation's chunk, read when the set is captured.  */
+    uint64_t  resident_bytes;
 };
 
 #define MP_SITE_CAP 256    /* per-thread aggregation buckets */
 
-struct __mp_tls {
-    uint64_t alloc_count;        /* number of allocations in this thread */
-    uint64_t bytes_until_sample; /* bytes remaining until next sample */
+/* Sites are keyed by (pc, label).  In per-CPU tables a slot is claimed
+   by setting pc to MP_SITE_BUSY until its label is in place; readers
+   skip such slots.  */
+#define MP_SITE_BUSY ((uintptr_t)1)
+
+/* Adaptive stride (GLIBC_MALLOC_PROFILE_MAX_SPS): every change of a
+   thread's effective stride is logged so dumps can be re-weighted.  */
+struct mp_stride_change {
+    uint64_t time_ns;      /* CLOCK_MONOTONIC */
+    uint64_t stride;       /* new stride in bytes */
+};
+
+#define MP_STRIDE_LOG_CAP 64   /* most recent changes kept per table */
+
+/* Profiler self-overhead, in mp_cycles() units.  The fast path is not
+   instrumented; these cover the work done per sample.  */
+struct mp_overhead {
+    uint64_t slow_cycles;    /* whole slow path, including the below */
+    uint64_t unwind_cycles;  /* capturing the call site and sizes */
+    uint64_t insert_cycles;  /* hash table probe and update */
+};
+
+/* Per-thread aggregation table.
+ *
+ * Records live in profiler-owned mappings rather than in TLS so that a
+ * dumper running on another thread (or in a signal handler) can always
+ * dereference them.  Like malloc arenas they are never freed: a thread
+ * joins the registry on its first sample, releases its record at exit,
+ * and a later thread may recycle it.
+ *
+ * The owning thread is the only writer.  It brackets every update with
+ * SEQ (odd while writing), so readers can copy a consistent view with
+ * __mp_rec_snapshot without locking or stopping the owner.  */
+struct mp_thread_rec {
+    struct mp_thread_rec *next;  /* registry link, never unlinked */
+    uint32_t in_use;             /* 1 while owned by a live thread */
+    uint32_t seq;                /* seqlock sequence, odd while writing */
+    uint64_t thread_index;       /* registry join order of the owner */
+
+    uint64_t alloc_count;        /* owner's alloc_count at last publish */
     uint64_t sample_count;       /* total samples in this thread */
-    uint64_t rng;                /* reserved for future use */
+    uint64_t site_overflow;      /* samples that couldn't be placed in table */
 
     /* Aggregation by call site (PC). */
     struct mp_site sites[MP_SITE_CAP];
-    uint64_t site_overflow;      /* samples that couldn't be placed in table */
+
+    uint64_t stride_changes;     /* total, may exceed MP_STRIDE_LOG_CAP */
+    struct mp_stride_change stride_log[MP_STRIDE_LOG_CAP];
+
+    struct mp_overhead overhead;
+};
+
+/* Per-CPU aggregation table (GLIBC_MALLOC_PROFILE_PERCPU=1).
+ *
+ * Shared by every thread that samples while running on the CPU, so
+ * memory is O(cores) instead of O(threads).  The CPU comes from the rseq
+ * area glibc registers for each thread; updates are relaxed atomics that
+ * stay local to the CPU's cache and only race after a migration or
+ * preemption.  */
+struct mp_cpu_table {
+    uint64_t alloc_count;        /* allocations flushed by sampling threads */
+    uint64_t sample_count;
+    uint64_t site_overflow;
+    struct mp_site sites[MP_SITE_CAP];
+
+    uint64_t stride_changes;     /* changes by threads running here */
+    struct mp_stride_change stride_log[MP_STRIDE_LOG_CAP];
+
+    struct mp_overhead overhead;
+};
+
+/* Profiling region (malloc_profile_region_begin).  Shared by every
+ * thread that enters a region of this name and updated with relaxed
+ * atomics like the per-CPU tables.  ALLOC_COUNT and ALLOC_BYTES are
+ * exact; they are recovered from the countdown when a thread leaves
+ * the region, so the fast path does no extra work.  */
+#define MP_REGION_CAP      16
+#define MP_REGION_NAME_LEN 64
+
+struct mp_region {
+    uint32_t ready;              /* NAME is set, published with release */
+    char name[MP_REGION_NAME_LEN];
+    uint64_t alloc_count;        /* exact, folded in at region end */
+    uint64_t alloc_bytes;        /* exact, folded in at region end */
+    uint64_t sample_count;
+    uint64_t site_overflow;
+    struct mp_site sites[MP_SITE_CAP];
+};
+
+/* Large allocations (GLIBC_MALLOC_PROFILE_LARGE), recorded exactly
+ * instead of sampled, in one table shared by all threads.  Each site's
+ * est_bytes is its exact byte total.  */
+struct mp_large_table {
+    uint64_t alloc_count;
+    uint64_t alloc_bytes;
+    uint64_t site_overflow;
+    struct mp_site sites[MP_SITE_CAP];
+};
+
+/* Live sampled allocations (GLIBC_MALLOC_PROFILE_LIVE=1).
+ *
+ * One process-wide open-addressing table keyed by the returned pointer,
+ * filled on the slow path and emptied by free.  Slots are claimed by
+ * setting PTR to MP_LIVE_BUSY until the payload is in place; freed
+ * entries become MP_LIVE_TOMB and are reused by later inserts.
+ *
+ * free consults __mp_live_filter first: a counting filter with one byte
+ * per pointer hash, nonzero if some live entry may have that hash.  It
+ * is NULL while nothing is tracked, so an unsampled free costs a load
+ * and a branch.  */
+struct mp_live {
+    uintptr_t ptr;         /* 0 = empty, see MP_LIVE_TOMB / MP_LIVE_BUSY */
+    uintptr_t pc;
+    uint32_t  label;
+    uint32_t  born;        /* cold tracking: scan epoch at insert */
+    uint64_t  size;        /* requested bytes */
+    uint64_t  usable;      /* usable size of the chunk */
+    uint64_t  est;         /* samples x stride, as recorded at the site */
+    uint32_t  written;     /* cold tracking: last epoch seen written */
+    uint32_t  thread;      /* __mp_tls.thread_id of the allocating thread */
+    uint32_t  node;        /* NUMA: node the allocating thread ran on */
+    uint32_t  reserved;
+};
+
+#define MP_LIVE_TOMB ((uintptr_t)1)
+#define MP_LIVE_BUSY ((uintptr_t)2)
+
+#define MP_LIVE_CAP         (1U << 17)   /* entries */
+#define MP_LIVE_FILTER_BITS 16           /* filter has 2^N bytes */
+
+extern uint8_t *__mp_live_filter;
+
+static inline size_t
+mp_live_filter_index(const void *ptr)
+{
+    uint64_t h = ((uint64_t)(uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> (64 - MP_LIVE_FILTER_BITS));
+}
+
+struct __mp_tls {
+    uint64_t alloc_count;        /* number of allocations in this thread
+                                    (per-CPU mode: not yet flushed) */
+    uint64_t bytes_until_sample; /* bytes remaining until next sample */
+    uint64_t rng;                /* interval generator state */
+    struct mp_thread_rec *rec;   /* registry record, NULL before first sample */
+
+    uint64_t stride;             /* effective sample stride in bytes */
+    uint64_t window_samples;     /* adaptive stride: samples this window */
+    uint64_t window_start_ns;    /* adaptive stride: thread CPU time */
+
+    uint32_t label;              /* current label id, 0 = none */
+
+    uint32_t region;             /* current region id, 0 = none */
+    uint64_t countdown_start;    /* bytes_until_sample at its last reset */
+    uint64_t region_bytes;       /* region bytes up to that reset */
+    uint64_t region_alloc_base;  /* alloc_count when the region began */
+    uint64_t outer_stride;       /* countdown outside the region */
+    uint64_t outer_remaining;
+
+    int64_t live_delta;          /* peak snapshots: unflushed live bytes */
+
+    uint32_t thread_id;          /* 1 + order of first allocation */
+
+    struct mp_tcache_slot *tcache_slot;  /* tcache report registration */
 };
 
 extern __thread struct __mp_tls __mp_tls_state;
 
-/* Called from malloc.c on each successful allocation. */
-void __mp_on_alloc(size_t size, void *ptr);
+/* Called from malloc.c on each successful allocation.  CALLER is the
+   return address of the public allocation entry point.  */
+void __mp_on_alloc(size_t size, void *ptr, const void *caller);
+
+/* Requests of at least this many bytes that bypass the tcache are
+   reported with __mp_on_large rather than __mp_on_alloc; 0 means the
+   allocator's mmap threshold, SIZE_MAX that the mode is off.  */
+extern size_t __mp_large_bytes;
+
+/* Called from malloc.c for a large request: records it exactly, outside
+   the sampling countdown.  CALLOC and CLEARED are as for
+   __mp_on_calloc.  */
+void __mp_on_large(size_t size, void *ptr, int calloc, size_t cleared,
+                   const void *caller);
+
+/* Called from malloc.c on each successful calloc of SIZE bytes at PTR,
+   which zeroed CLEARED bytes (0 for memory fresh from the kernel).  */
+void __mp_on_calloc(size_t size, void *ptr, size_t cleared,
+                    const void *caller);
+
+/* Called from malloc.c on each successful realloc of OLDMEM to SIZE
+   bytes at NEWMEM.  OLD_SIZE is the usable size of OLDMEM, KIND an
+   MP_REALLOC_* code and COPIED the bytes moved for MP_REALLOC_COPY.
+   Sampled by SIZE like an allocation, or recorded exactly like
+   __mp_on_large if LARGE; also drops OLDMEM from the live table.  */
+void __mp_on_realloc(void *oldmem, void *newmem, size_t size,
+                     size_t old_size, unsigned int kind, size_t copied,
+                     int large, const void *caller);
+
+/* Called from malloc.c when PTR is freed and its __mp_live_filter byte
+   is set: drops PTR from the live table if it is there.  */
+void __mp_on_free(void *ptr);
+
+/* Heap size (arena system_mem plus mmapped chunks) at which malloc.c
+   should call __mp_on_heap_grow; SIZE_MAX while growth snapshots are
+   off.  */
+extern size_t __mp_growth_next;
+
+/* Called from malloc.c, possibly with an arena locked, when the heap
+   has reached HEAP_BYTES >= __mp_growth_next.  */
+void __mp_on_heap_grow(size_t heap_bytes);
+
+/* Called from malloc.c when a thread exits: dumps and releases its
+   registry record.  */
+void __mp_on_thread_exit(void);
+
+/* Called from malloc.c in the child after fork: releases the records of
+   threads that do not exist in the child.  */
+void __mp_on_fork_child(void);
+
+/* Free memory held back from the application, for the thread cache
+   report (GLIBC_MALLOC_PROFILE_TCACHE=1): one record per bin that
+   holds chunks.  */
+#define MP_FREE_TCACHE   0     /* OWNER is the thread's TID */
+#define MP_FREE_FAST     1     /* OWNER is the arena number, main = 0 */
+#define MP_FREE_UNSORTED 2
+#define MP_FREE_SMALL    3
+#define MP_FREE_LARGE    4
+#define MP_FREE_TOP      5     /* the arena's top chunk */
+
+struct mp_free_bin {
+    uint32_t owner;
+    uint32_t kind;               /* MP_FREE_* */
+    uint32_t bin;                /* index among the owner's bins */
+    uint32_t count;              /* free chunks */
+    uint64_t chunk_size;         /* smallest chunk size the bin holds */
+    uint64_t bytes;              /* chunk bytes; for tcache bins above the
+                                    small sizes, count x chunk_size */
+};
+
+/* Called from malloc.c when the calling thread's tcache has been set up
+   at TCACHE, and with NULL before it is released at thread exit.  */
+void __mp_on_tcache(void *tcache);
+
+#ifndef MPROF_SHIM
+/* Provided by malloc.c.  Fill OUT with up to N records for the bins of
+   the thread cache at TCACHE that hold chunks, from its counters alone:
+   the owning thread may be using it.  Returns the number filled.  */
+size_t __malloc_tcache_bins(const void *tcache, struct mp_free_bin *out,
+                            size_t n);
+
+/* Likewise for the top chunk and free lists of every arena, locking
+   each arena in turn while its bins are walked.  */
+size_t __malloc_arena_bins(struct mp_free_bin *out, size_t n);
+
+/* Called from malloc_info to append the profiler's section to FP, as
+   XML elements or, if JSON, as a "profiler" member of the object.  */
+void __mp_info(FILE *fp, int json);
+#endif
+
+#ifdef MPROF_SHIM
+/* Provided by the LD_PRELOAD shim, which has no malloc thread-exit
+   hook: called on a thread's first profiled allocation so the shim can
+   arrange for __mp_on_thread_exit to run when the thread exits.  */
+void __mp_shim_thread_start(void);
+#endif
+
+/* Registry enumeration for dumpers.  Returns the most recently joined
+   record; follow ->next.  Records with in_use == 0 carry no data.  */
+struct mp_thread_rec *__mp_registry_first(void);
+
+/* Copy a consistent view of REC into OUT.  Returns 0 on success, -1 if
+   the owner kept the record busy (e.g. the caller interrupted it).  */
+int __mp_rec_snapshot(const struct mp_thread_rec *rec,
+                      struct mp_thread_rec *out);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,37 @@
+/* Sampling profiler interfaces for glibc configured without
+   --enable-malloc-profiler.  The real ones are in malloc_prof.c.  */
+
+#include <malloc.h>
+
+unsigned int
+malloc_profile_label (const char *key, const char *value)
+{
+  return 0;
+}
+
+unsigned int
+malloc_profile_set_label (const char *key, const char *value)
+{
+  return 0;
+}
+
+unsigned int
+malloc_profile_push_label (unsigned int id)
+{
+  return 0;
+}
+
+void
+malloc_profile_pop_label (unsigned int prev)
+{
+}
+
+void
+malloc_profile_region_begin (const char *name)
+{
+}
+
+void
+malloc_profile_region_end (void)
+{
+}
@@ -0,0 +1,178 @@
+/* Test malloc_arena_stats.
+   Copyright (C) 2025 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+/* Test that malloc_arena_stats is exported, that its totals add up
+   over the arenas, and, where the arena counters are kept, that they
+   follow allocations and frees.  */
+
+#include <array_length.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <support/check.h>
+
+#include "tst-malloc-aux.h"
+
+/* More than any thread cache holds, so that frees reach the arena.
+   The size is above the fastbin limit.  */
+#define NBLOCKS 4096
+#define BLOCK_SIZE 200
+
+static void *blocks[NBLOCKS];
+
+#ifdef USE_MALLOC_PROF
+static void *aligned[NBLOCKS];
+
+/* Chunks in the thread cache count as allocated, so the number of
+   live chunks may exceed the blocks the test holds by what the cache
+   keeps.  */
+# define CACHE_SLACK 64
+
+/* The chunks the arena counters consider allocated.  */
+static size_t
+live (struct malloc_arena_stats s)
+{
+  return s.allocs - s.frees;
+}
+#endif
+
+static struct malloc_arena_stats stats[64];
+
+/* Fill STATS, check the totals against the arenas, and return the
+   totals.  */
+static struct malloc_arena_stats
+read_stats (const char *msg)
+{
+  size_t k = malloc_arena_stats (stats, array_length (stats));
+  TEST_VERIFY_EXIT (k >= 2);
+  TEST_VERIFY_EXIT (k <= array_length (stats));
+
+  struct malloc_arena_stats sum;
+  memset (&sum, 0, sizeof (sum));
+  for (size_t i = 1; i < k; ++i)
+    {
+      TEST_VERIFY (stats[i].in_use <= stats[i].system);
+      TEST_COMPARE (stats[i].mmapped, 0);
+      TEST_COMPARE (stats[i].nmmaps, 0);
+      sum.system += stats[i].system;
+      sum.in_use += stats[i].in_use;
+      sum.unused += stats[i].unused;
+      sum.allocs += stats[i].allocs;
+      sum.frees += stats[i].frees;
+    }
+  TEST_COMPARE (stats[0].system, sum.system);
+  TEST_COMPARE (stats[0].in_use, sum.in_use);
+  TEST_COMPARE (stats[0].unused, sum.unused);
+  TEST_COMPARE (stats[0].allocs, sum.allocs);
+  TEST_COMPARE (stats[0].frees, sum.frees);
+
+  printf ("%s: arenas=%zu system=%zu in_use=%zu unused=%zu mmapped=%zu "
+	  "nmmaps=%zu allocs=%zu frees=%zu\n", msg, k - 1, stats[0].system,
+	  stats[0].in_use, stats[0].unused, stats[0].mmapped, stats[0].nmmaps,
+	  stats[0].allocs, stats[0].frees);
+  return stats[0];
+}
+
+static int
+do_test (void)
+{
+  /* With no room, only the number of entries is returned.  */
+  size_t k = malloc_arena_stats (NULL, 0);
+  TEST_VERIFY (k >= 2);
+
+  struct malloc_arena_stats before = read_stats ("before");
+
+  for (int i = 0; i < NBLOCKS; ++i)
+    {
+      blocks[i] = malloc (BLOCK_SIZE);
+      TEST_VERIFY_EXIT (blocks[i] != NULL);
+    }
+  struct malloc_arena_stats during = read_stats ("during");
+
+  for (int i = 0; i < NBLOCKS; ++i)
+    free (blocks[i]);
+  struct malloc_arena_stats after = read_stats ("after");
+
+  TEST_VERIFY (during.system >= before.system);
+
+  /* A large block is mmapped and shows up in the totals only.  */
+  void *big = malloc (64 * 1024 * 1024);
+  TEST_VERIFY_EXIT (big != NULL);
+  struct malloc_arena_stats mapped = read_stats ("mapped");
+  TEST_VERIFY (mapped.mmapped >= 64 * 1024 * 1024);
+  TEST_VERIFY (mapped.nmmaps >= 1);
+  free (big);
+
+#ifdef USE_MALLOC_PROF
+  TEST_VERIFY (during.allocs >= before.allocs + NBLOCKS / 2);
+  TEST_VERIFY (during.in_use >= before.in_use + NBLOCKS / 2 * BLOCK_SIZE);
+  TEST_VERIFY (after.frees >= during.frees + NBLOCKS / 2);
+  TEST_VERIFY (after.in_use < during.in_use);
+  TEST_COMPARE (during.unused, during.system - during.in_use);
+
+  /* Shrinking a block in place splits off a free chunk, which must
+     not change the count of live chunks.  The sizes are above the
+     fastbin limit and not cached yet.  */
+  before = read_stats ("before realloc");
+  for (int i = 0; i < NBLOCKS; ++i)
+    {
+      blocks[i] = malloc (4000);
+      TEST_VERIFY_EXIT (blocks[i] != NULL);
+    }
+  struct malloc_arena_stats grown = read_stats ("grown");
+  TEST_VERIFY (live (grown) >= live (before) + NBLOCKS);
+  TEST_VERIFY (live (grown) <= live (before) + NBLOCKS + CACHE_SLACK);
+  for (int i = 0; i < NBLOCKS; ++i)
+    {
+      void *p = realloc (blocks[i], 1000);
+      TEST_VERIFY_EXIT (p == blocks[i]);
+    }
+  struct malloc_arena_stats shrunk = read_stats ("shrunk");
+  TEST_COMPARE (live (shrunk), live (grown));
+
+  /* memalign frees the alignment padding around each block, which
+     must not count as frees either.  */
+  for (int i = 0; i < NBLOCKS; ++i)
+    {
+      aligned[i] = memalign (256, 300);
+      TEST_VERIFY_EXIT (aligned[i] != NULL);
+    }
+  struct malloc_arena_stats aligned_stats = read_stats ("aligned");
+  TEST_VERIFY (live (aligned_stats) >= live (shrunk) + NBLOCKS);
+  TEST_VERIFY (live (aligned_stats)
+	       <= live (shrunk) + NBLOCKS + CACHE_SLACK);
+
+  for (int i = 0; i < NBLOCKS; ++i)
+    {
+      free (blocks[i]);
+      free (aligned[i]);
+    }
+  after = read_stats ("after realloc");
+  TEST_VERIFY (live (after) >= live (before));
+  TEST_VERIFY (live (after) <= live (before) + 3 * CACHE_SLACK);
+#else
+  /* The counters are not kept.  */
+  TEST_COMPARE (during.allocs, 0);
+  TEST_COMPARE (after.frees, 0);
+  TEST_COMPARE (after.in_use, 0);
+#endif
+
+  return 0;
+}
+
+#include <support/test-driver.c>
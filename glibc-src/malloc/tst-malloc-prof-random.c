@@ -0,0 +1,96 @@
+/* Test the profiler's estimates with random sampling intervals.
+   Copyright (C) 2025 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+/* Run with GLIBC_MALLOC_PROFILE_RANDOM=1 or GLIBC_MALLOC_PROFILE_SEED
+   (see the Makefile): allocate a known number of bytes from one call
+   site and check, through malloc_info, that the mean sampling interval
+   is the stride and that the site's estimated bytes match what it
+   allocated.  */
+
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <support/check.h>
+#include <support/xmemstream.h>
+
+#include "tst-malloc-aux.h"
+
+#define NALLOCS 1000000
+#define ALLOC_SIZE 1000
+
+/* Allowed relative error.  With the stride of 64 KiB set in the
+   Makefile the loop takes about 15000 samples, so both figures have a
+   standard deviation under 1%.  */
+#define TOLERANCE 0.05
+
+/* The number after "KEY": at or after P.  */
+static uint64_t
+json_number (const char *p, const char *key)
+{
+  char pattern[64];
+  snprintf (pattern, sizeof (pattern), "\"%s\":", key);
+  const char *q = strstr (p, pattern);
+  TEST_VERIFY_EXIT (q != NULL);
+  return strtoull (q + strlen (pattern), NULL, 10);
+}
+
+static void
+check_close (const char *what, double got, double want)
+{
+  printf ("%s: %.0f, expected %.0f\n", what, got, want);
+  TEST_VERIFY (got >= want * (1 - TOLERANCE));
+  TEST_VERIFY (got <= want * (1 + TOLERANCE));
+}
+
+static int
+do_test (void)
+{
+  for (int i = 0; i < NALLOCS; ++i)
+    {
+      void *p = malloc (ALLOC_SIZE);
+      TEST_VERIFY_EXIT (p != NULL);
+      free (p);
+    }
+
+  struct xmemstream info;
+  xopen_memstream (&info);
+  TEST_COMPARE (malloc_info (MALLOC_INFO_JSON, info.out), 0);
+  xfclose_memstream (&info);
+
+  const char *prof = strstr (info.buffer, "\"profiler\":");
+  if (prof == NULL)
+    FAIL_UNSUPPORTED ("profiler not enabled");
+
+  uint64_t stride = json_number (prof, "stride");
+  uint64_t samples = json_number (prof, "sample_count");
+  const char *sites = strstr (prof, "\"sites\":[");
+  TEST_VERIFY_EXIT (sites != NULL);
+  /* Sites come by estimated bytes; the loop's is far ahead.  */
+  uint64_t est_bytes = json_number (sites, "est_bytes");
+
+  double total = (double) NALLOCS * ALLOC_SIZE;
+  TEST_VERIFY_EXIT (samples > 0);
+  check_close ("mean interval", total / samples, stride);
+  check_close ("estimated bytes", est_bytes, total);
+
+  free (info.buffer);
+  return 0;
+}
+
+#include <support/test-driver.c>
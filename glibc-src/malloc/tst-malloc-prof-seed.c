@@ -0,0 +1 @@
+#include "tst-malloc-prof-random.c"
@@ -13,6 +13,7 @@ NUM_RUNS = 100
 BASE_DIR = Path.home() / "Desktop" / "malloc-benchmarks"
 LOADER = Path.home() / "Desktop" / "glibc-install" / "lib" / "ld-linux-aarch64.so.1"
 LIB_PATH = Path.home() / "Desktop" / "glibc-install" / "lib"
+SHIM = Path.home() / "Desktop" / "mprof-shim" / "libmprof.so"
 
 BENCHES = [
     "bench_fixed",
@@ -53,6 +54,15 @@ MODES = {
             f"./{bench}",
         ],
     },
+    "shim": {
+        "label": "System + libmprof.so",
+        "env": {
+            "LD_PRELOAD": str(SHIM),
+            "GLIBC_MALLOC_PROFILE": "1",
+            "GLIBC_MALLOC_PROFILE_BYTES": "262144",  # same stride as custom_on
+        },
+        "cmd": lambda bench: [f"./{bench}"],
+    },
 }
 
 
@@ -128,34 +138,46 @@ def main():
         f"{'system':>10} "
         f"{'cust_off':>10} "
         f"{'cust_on':>10} "
+        f"{'shim':>10} "
         f"{'ON vs sys%':>12} "
-        f"{'ON vs off%':>12}"
+        f"{'ON vs off%':>12} "
+        f"{'shim vs sys%':>13} "
+        f"{'shim vs ON%':>12}"
     )
-    print("-" * 74)
+    print("-" * 111)
 
     for bench in BENCHES:
         sys_mean = stats.mean(results[(bench, "system")])
         off_mean = stats.mean(results[(bench, "custom_off")])
         on_mean  = stats.mean(results[(bench, "custom_on")])
+        shim_mean = stats.mean(results[(bench, "shim")])
 
         on_vs_sys = pct_overhead(sys_mean, on_mean)
         on_vs_off = pct_overhead(off_mean, on_mean)
+        shim_vs_sys = pct_overhead(sys_mean, shim_mean)
+        shim_vs_on = pct_overhead(on_mean, shim_mean)
 
         print(
             f"{bench:<18} "
             f"{sys_mean:10.3f} "
             f"{off_mean:10.3f} "
             f"{on_mean:10.3f} "
+            f"{shim_mean:10.3f} "
             f"{on_vs_sys:12.2f} "
-            f"{on_vs_off:12.2f}"
+            f"{on_vs_off:12.2f} "
+            f"{shim_vs_sys:13.2f} "
+            f"{shim_vs_on:12.2f}"
         )
 
     print("\nNotes:")
     print("  - system     = default system glibc")
     print("  - cust_off   = custom glibc, profiler runtime OFF")
     print("  - cust_on    = custom glibc, profiler runtime ON")
+    print("  - shim       = system glibc with LD_PRELOAD=libmprof.so, profiler ON")
     print("  - ON vs sys% = (cust_on - system) / system * 100")
-    print("  - ON vs off% = (cust_on - cust_off) / cust_off * 100\n")
+    print("  - ON vs off% = (cust_on - cust_off) / cust_off * 100")
+    print("  - shim vs sys% = (shim - system) / system * 100")
+    print("  - shim vs ON%  = (shim - cust_on) / cust_on * 100\n")
 
 
 if __name__ == "__main__":
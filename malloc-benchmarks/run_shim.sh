@@ -0,0 +1,20 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+SHIM="$HOME/Desktop/mprof-shim/libmprof.so"
+
+echo "== System glibc + libmprof.so (profiler ON) =="
+
+for b in bench_fixed bench_var bench_mt; do
+    echo
+    echo "-- $b (shim, GLIBC_MALLOC_PROFILE=1) --"
+    LD_PRELOAD="$SHIM" GLIBC_MALLOC_PROFILE=1 \
+    "./$b"
+done
+
+for b in bench_churn bench_churn_mt; do
+    echo
+    echo "-- $b (shim ON) --"
+    LD_PRELOAD="$SHIM" GLIBC_MALLOC_PROFILE=1 \
+        "./$b"
+done
\ No newline at end of file
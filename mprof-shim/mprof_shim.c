@@ -0,0 +1,308 @@
+/* LD_PRELOAD build of the sampling profiler for a stock glibc.
+ *
+ * Interposes the malloc family, forwards every call to the next
+ * definition (normally libc's) found with RTLD_NEXT, and reports
+ * successful allocations to the engine in glibc-src/malloc/malloc_prof.c,
+ * which is compiled into the same library.  Configuration, the per-thread
+ * countdown and the dump files are the same as for the in-libc build.  */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "malloc_prof.h"
+
+static void *(*next_malloc)(size_t);
+static void *(*next_calloc)(size_t, size_t);
+static void *(*next_realloc)(void *, size_t);
+static void (*next_free)(void *);
+static void *(*next_memalign)(size_t, size_t);
+static int (*next_posix_memalign)(void **, size_t, size_t);
+static void *(*next_aligned_alloc)(size_t, size_t);
+static void *(*next_valloc)(size_t);
+static void *(*next_pvalloc)(size_t);
+
+
+/* ------------------------------------------------------
+ * Symbol resolution
+ * ----------------------------------------------------*/
+
+/* dlsym may allocate (e.g. for dlerror state) before the next allocator
+   is known.  Those requests are served from this buffer, which is zero
+   like fresh calloc memory, and are never returned.  */
+static char mp_shim_boot_buf[4096] __attribute__((aligned(16)));
+static size_t mp_shim_boot_used;
+static int mp_shim_resolving;
+
+static void *
+mp_shim_boot_alloc(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    if (size > sizeof mp_shim_boot_buf - mp_shim_boot_used) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *p = mp_shim_boot_buf + mp_shim_boot_used;
+    mp_shim_boot_used += size;
+    return p;
+}
+
+static inline int
+mp_shim_is_boot(const void *p)
+{
+    return (const char *)p >= mp_shim_boot_buf
+           && (const char *)p < mp_shim_boot_buf + sizeof mp_shim_boot_buf;
+}
+
+static void
+mp_shim_resolve(void)
+{
+    mp_shim_resolving = 1;
+    next_calloc         = dlsym(RTLD_NEXT, "calloc");
+    next_realloc        = dlsym(RTLD_NEXT, "realloc");
+    next_free           = dlsym(RTLD_NEXT, "free");
+    next_memalign       = dlsym(RTLD_NEXT, "memalign");
+    next_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    next_aligned_alloc  = dlsym(RTLD_NEXT, "aligned_alloc");
+    next_valloc         = dlsym(RTLD_NEXT, "valloc");
+    next_pvalloc        = dlsym(RTLD_NEXT, "pvalloc");
+    /* Last: a non-NULL next_malloc means everything is resolved.  */
+    __atomic_store_n(&next_malloc, dlsym(RTLD_NEXT, "malloc"),
+                     __ATOMIC_RELEASE);
+    mp_shim_resolving = 0;
+}
+
+/* Returns 0 if the caller must fall back to the boot buffer.  */
+static inline int
+mp_shim_ready(void)
+{
+    if (__glibc_likely(__atomic_load_n(&next_malloc, __ATOMIC_ACQUIRE)
+                       != NULL))
+        return 1;
+    if (mp_shim_resolving)
+        return 0;
+    mp_shim_resolve();
+    return 1;
+}
+
+
+/* ------------------------------------------------------
+ * Thread exit and fork
+ * ----------------------------------------------------*/
+
+/* A stock glibc does not call the profiler when a thread exits, so a
+   key destructor stands in for the hook in __malloc_arena_thread_freeres.
+   The main thread is covered by the engine's destructor.  */
+static pthread_key_t mp_shim_exit_key;
+static pthread_once_t mp_shim_exit_once = PTHREAD_ONCE_INIT;
+
+static void
+mp_shim_thread_exit(void *arg)
+{
+    (void)arg;
+    __mp_on_thread_exit();
+}
+
+static void
+mp_shim_exit_key_init(void)
+{
+    (void)pthread_key_create(&mp_shim_exit_key, mp_shim_thread_exit);
+}
+
+void
+__mp_shim_thread_start(void)
+{
+    pthread_once(&mp_shim_exit_once, mp_shim_exit_key_init);
+    (void)pthread_setspecific(mp_shim_exit_key, (void *)1);
+}
+
+static void __attribute__((constructor))
+mp_shim_init(void)
+{
+    mp_shim_ready();
+    (void)pthread_atfork(NULL, NULL, __mp_on_fork_child);
+}
+
+
+/* ------------------------------------------------------
+ * Interposed allocation functions
+ * ----------------------------------------------------*/
+
+/* The shim cannot read the allocator's mmap threshold, so for
+   GLIBC_MALLOC_PROFILE_LARGE=mmap it uses glibc's default.  */
+#define MP_SHIM_MMAP_THRESHOLD (128 * 1024)
+
+static inline int
+mp_shim_is_large(size_t size)
+{
+    size_t large = __mp_large_bytes;
+    return __glibc_unlikely(large != SIZE_MAX)
+           && size >= (large != 0 ? large : MP_SHIM_MMAP_THRESHOLD);
+}
+
+/* Always inlined so that the recorded call site is the wrapper's
+   return address, i.e. the application's call.  */
+static __attribute__((always_inline)) inline void *
+mp_shim_on_alloc(size_t size, void *ptr)
+{
+    if (ptr == NULL)
+        return NULL;
+    if (mp_shim_is_large(size))
+        __mp_on_large(size, ptr, 0, 0, __builtin_return_address(0));
+    else
+        __mp_on_alloc(size, ptr, __builtin_return_address(0));
+    return ptr;
+}
+
+/* The next calloc does not say whether it zeroed the block.  glibc
+   skips clearing chunks fresh from mmap, which start one chunk header
+   into a page and end on a page boundary; anything else is assumed
+   cleared.  Fresh sbrked memory is not recognised.  */
+static inline size_t
+mp_shim_calloc_cleared(void *ptr)
+{
+    size_t usable = malloc_usable_size(ptr);
+    size_t hdr = 2 * sizeof(size_t);
+    if (((uintptr_t)ptr & 4095) == hdr && ((usable + hdr) & 4095) == 0
+        && usable >= 128 * 1024 - hdr)
+        return 0;
+    return usable;
+}
+
+static inline void
+mp_shim_on_free(void *ptr)
+{
+    const uint8_t *filter = __mp_live_filter;
+    if (__glibc_unlikely(filter != NULL)
+        && filter[mp_live_filter_index(ptr)] != 0)
+        __mp_on_free(ptr);
+}
+
+void *
+malloc(size_t size)
+{
+    if (!mp_shim_ready())
+        return mp_shim_boot_alloc(size);
+    return mp_shim_on_alloc(size, next_malloc(size));
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    size_t bytes;
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (!mp_shim_ready())
+        return mp_shim_boot_alloc(bytes);
+    void *p = next_calloc(nmemb, size);
+    if (p == NULL)
+        return NULL;
+    if (mp_shim_is_large(bytes))
+        __mp_on_large(bytes, p, 1, mp_shim_calloc_cleared(p),
+                      __builtin_return_address(0));
+    else
+        __mp_on_calloc(bytes, p, mp_shim_calloc_cleared(p),
+                       __builtin_return_address(0));
+    return p;
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    if (!mp_shim_ready())
+        return mp_shim_boot_alloc(size);
+    if (mp_shim_is_boot(ptr)) {
+        /* The old size is unknown; copy what the buffer can hold.  */
+        void *p = next_malloc(size);
+        if (p != NULL) {
+            size_t avail = mp_shim_boot_buf + sizeof mp_shim_boot_buf
+                           - (char *)ptr;
+            memcpy(p, ptr, size < avail ? size : avail);
+        }
+        return mp_shim_on_alloc(size, p);
+    }
+    /* The next realloc does not say how it resized the block: a move is
+       reported as a copy of the old usable size (or of SIZE, if less),
+       which is what it costs unless it was an mremap.  */
+    size_t old_size = ptr != NULL ? malloc_usable_size(ptr) : 0;
+    void *p = next_realloc(ptr, size);
+    if (p == NULL) {
+        /* realloc(ptr, 0) frees PTR and returns NULL.  */
+        if (ptr != NULL && size == 0)
+            mp_shim_on_free(ptr);
+        return NULL;
+    }
+    unsigned int kind = MP_REALLOC_NEW;
+    size_t copied = 0;
+    if (ptr != NULL && p == ptr) {
+        kind = MP_REALLOC_IN_PLACE;
+    } else if (ptr != NULL) {
+        kind = MP_REALLOC_COPY;
+        copied = old_size < size ? old_size : size;
+    }
+    __mp_on_realloc(ptr, p, size, old_size, kind, copied,
+                    mp_shim_is_large(size), __builtin_return_address(0));
+    return p;
+}
+
+void
+free(void *ptr)
+{
+    if (ptr == NULL || mp_shim_is_boot(ptr))
+        return;
+    if (!mp_shim_ready())
+        return;
+    mp_shim_on_free(ptr);
+    next_free(ptr);
+}
+
+void *
+memalign(size_t alignment, size_t size)
+{
+    if (!mp_shim_ready())
+        return NULL;
+    return mp_shim_on_alloc(size, next_memalign(alignment, size));
+}
+
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (!mp_shim_ready())
+        return ENOMEM;
+    int ret = next_posix_memalign(memptr, alignment, size);
+    if (ret == 0)
+        mp_shim_on_alloc(size, *memptr);
+    return ret;
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size)
+{
+    if (!mp_shim_ready())
+        return NULL;
+    return mp_shim_on_alloc(size, next_aligned_alloc(alignment, size));
+}
+
+void *
+valloc(size_t size)
+{
+    if (!mp_shim_ready())
+        return NULL;
+    return mp_shim_on_alloc(size, next_valloc(size));
+}
+
+void *
+pvalloc(size_t size)
+{
+    if (!mp_shim_ready())
+        return NULL;
+    return mp_shim_on_alloc(size, next_pvalloc(size));
+}
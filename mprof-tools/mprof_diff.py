@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""Compare two profiles site by site, e.g. to gate merges in CI.
+
+Sites are matched by (module, offset, label), which is stable across
+runs and ASLR.  Exits with status 1 if any site's estimated bytes grew
+by more than --threshold percent (sites new in NEW count as growth).
+Profiles recorded with GLIBC_MALLOC_PROFILE_SEED and a fixed stride are
+reproducible, so any difference is a real change in allocation
+behaviour."""
+import argparse
+import sys
+
+from mprof_read import parse_profile, site_key, site_location
+
+def by_site(prof):
+    totals = {}
+    for s in prof["sites"]:
+        key = site_key(prof, s)
+        if key not in totals:
+            totals[key] = {"est_bytes": 0, "site": s}
+        totals[key]["est_bytes"] += s["est_bytes"]
+    return totals
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("old", help="baseline profile .bin file")
+    ap.add_argument("new", help="profile .bin file to check")
+    ap.add_argument("-e", "--binary", help="path to executable for symbolization")
+    ap.add_argument("--threshold", type=float, default=5.0,
+                    help="allowed growth per site in percent (default 5)")
+    ap.add_argument("--min-bytes", type=int, default=0,
+                    help="ignore sites below this many estimated bytes in NEW")
+    args = ap.parse_args()
+
+    old_prof = parse_profile(args.old)
+    new_prof = parse_profile(args.new)
+    old_sites = by_site(old_prof)
+    new_sites = by_site(new_prof)
+
+    failed = False
+    for key in sorted(set(old_sites) | set(new_sites), key=lambda k: (
+            k[0] or "", k[1], k[2])):
+        before = old_sites.get(key, {"est_bytes": 0})["est_bytes"]
+        entry = new_sites.get(key)
+        after = entry["est_bytes"] if entry else 0
+        if before == after or after < args.min_bytes:
+            continue
+        grew = after > before * (1 + args.threshold / 100.0)
+        pct = (after - before) / before * 100.0 if before else float("inf")
+        module, offset, label = key
+        where = f"{module or '<main>'}+{hex(offset)}" if module is not None \
+                else hex(offset)
+        line = f"{'GREW' if grew else '    '} {where} {before} -> {after} ({pct:+.1f}%)"
+        if label:
+            line += f" label={label}"
+        if entry:
+            loc = site_location(new_prof, entry["site"], args.binary)
+            if loc:
+                line += f" {loc}"
+        print(line)
+        failed |= grew
+
+    sys.exit(1 if failed else 0)
+
+if __name__ == "__main__":
+    main()
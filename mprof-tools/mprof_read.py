@@ -1,10 +1,53 @@
 #!/usr/bin/env python3
+import os
 import struct
 import subprocess
 import argparse
 
-HDR_FMT = "<Q I I Q Q Q Q Q"    # mp_file_header, little-endian
-SITE_FMT = "<Q Q Q"             # mp_file_site
+HDR_FMT = "<Q I I Q Q Q Q Q"    # mp_file_header, little-endian (v1 prefix)
+HDR2_FMT = "<I I Q"             # v2: site_size, n_sections, est_bytes
+HDR_OVERHEAD_FMT = "<Q Q Q Q Q" # v2: slow/unwind/insert/dump cycles, cycle_hz
+SITE_FMT = "<Q Q Q"             # mp_file_site (v1 prefix)
+# v2 appends u64 fields; older files have fewer (site_size says how many)
+SITE_EXT_FIELDS = ("est_bytes", "label", "module", "offset", "usable_bytes")
+HIST_BUCKETS = 32               # u32 counts after the u64 fields
+REALLOC_FMT = "<Q Q 4I"         # after hist: old bytes, copied, by kind
+REALLOC_KINDS = ("new", "in_place", "mremap", "copy")
+CALLOC_FMT = "<Q I I"           # after realloc: cleared, samples, zeroed
+RESIDENT_FMT = "<Q"             # after calloc: est. resident (live sets)
+LIVE_SET_SECTIONS = ("leaks", "peak", "growth", "cold", "numa")
+SECTION_FMT = "<I I Q"          # mp_file_section
+
+SECTION_STRIDE_LOG = 1          # mp_stride_change: time_ns, stride
+SECTION_LABELS = 2              # mp_file_label: id, key, value
+LABEL_FMT = "<I I 64s 64s"
+SECTION_REGION = 3              # mp_file_region: name, exact alloc_bytes
+REGION_FMT = "<64s Q"
+SECTION_MODULES = 4             # mp_file_module: id, load_addr, path
+MODULE_FMT = "<I I Q 256s"
+SECTION_LEAKS = 5               # mp_file_leaks: outstanding, untracked
+LEAKS_FMT = "<Q Q"
+SECTION_PEAK = 6                # mp_file_peak: live_bytes, captures
+PEAK_FMT = "<Q Q"
+SECTION_GROWTH = 7              # mp_file_growth: seq, heap_bytes, prev
+GROWTH_FMT = "<Q Q Q"
+SECTION_LARGE = 8               # mp_file_large: threshold, alloc_bytes
+LARGE_FMT = "<Q Q"
+SECTION_COLD = 9                # mp_file_cold: min_size, age_ns, scans,
+COLD_FMT = "<Q Q Q Q Q"         #   aged, aged_bytes
+SECTION_FSHARE = 10             # mp_file_fshare: line_size, max_size,
+FSHARE_FMT = "<Q Q Q Q"         #   events, pair_overflow
+SECTION_FSHARE_PAIRS = 11       # mp_file_fshare_pair: site indexes, events
+FSHARE_PAIR_FMT = "<I I Q"
+SECTION_NUMA = 12               # mp_file_numa: nodes, single_node,
+NUMA_FMT = "<I I Q"             #   other_bytes
+SECTION_NUMA_SITES = 13         # mp_file_numa_bytes: site index, node, bytes
+SECTION_NUMA_CPUS = 14          # mp_file_numa_bytes: CPU node, node, bytes
+NUMA_BYTES_FMT = "<I I Q"
+NUMA_UNTOUCHED = 0xffffffff
+SECTION_FREE_BINS = 15          # mp_free_bin: owner, kind, bin, count,
+FREE_BIN_FMT = "<I I I I Q Q"   #   chunk_size, bytes
+FREE_KINDS = ("tcache", "fast", "unsorted", "small", "large", "top")
 
 def symbolize(pc, binary):
     if not binary:
@@ -18,45 +61,443 @@ def symbolize(pc, binary):
     except Exception:
         return ""
 
-def read_profile(path, binary=None, top=20):
+def parse_profile(path):
+    """Parse a v1 or v2 profile into a dict; unknown sections are kept raw."""
     with open(path, "rb") as f:
-        hdr_raw = f.read(struct.calcsize(HDR_FMT))
-        hdr = struct.unpack(HDR_FMT, hdr_raw)
-        magic, version, _, stride, alloc_count, sample_count, overflow, n_sites = hdr
-        estimated = sample_count * stride  # stride from header
+        data = f.read()
+
+    hdr = struct.unpack_from(HDR_FMT, data, 0)
+    magic, version, header_size, stride, alloc_count, sample_count, overflow, n_sites = hdr
+    prof = {
+        "version": version,
+        "stride": stride,
+        "alloc_count": alloc_count,
+        "sample_count": sample_count,
+        "overflow": overflow,
+        "sections": {},
+    }
+
+    if version == 1:
+        header_size = struct.calcsize(HDR_FMT)
+        site_size = struct.calcsize(SITE_FMT)
+        n_sections = 0
+        prof["est_bytes"] = sample_count * stride
+    else:
+        base = struct.calcsize(HDR_FMT)
+        site_size, n_sections, est_bytes = struct.unpack_from(HDR2_FMT, data, base)
+        prof["est_bytes"] = est_bytes
+        base += struct.calcsize(HDR2_FMT)
+        if header_size >= base + struct.calcsize(HDR_OVERHEAD_FMT):
+            prof["overhead"] = dict(zip(
+                ("slow_cycles", "unwind_cycles", "insert_cycles",
+                 "dump_cycles", "cycle_hz"),
+                struct.unpack_from(HDR_OVERHEAD_FMT, data, base)))
+
+    off = header_size
+    sites = []
+    n_ext = max(0, (site_size - struct.calcsize(SITE_FMT)) // 8)
+    n_ext = min(n_ext, len(SITE_EXT_FIELDS))
+    for _ in range(n_sites):
+        pc, sample_cnt, total_bytes = struct.unpack_from(SITE_FMT, data, off)
+        site = {"pc": pc, "samples": sample_cnt, "bytes": total_bytes,
+                "est_bytes": sample_cnt * stride, "label": 0,
+                "module": 0, "offset": pc}
+        ext = struct.unpack_from("<" + "Q" * n_ext, data,
+                                 off + struct.calcsize(SITE_FMT))
+        site.update(zip(SITE_EXT_FIELDS, ext))
+        if "usable_bytes" in site:
+            site["est_waste"] = est_waste(site)
+        hist_off = struct.calcsize(SITE_FMT) + 8 * len(SITE_EXT_FIELDS)
+        if site_size >= hist_off + 4 * HIST_BUCKETS:
+            site["hist"] = struct.unpack_from(f"<{HIST_BUCKETS}I", data,
+                                              off + hist_off)
+        realloc_off = hist_off + 4 * HIST_BUCKETS
+        if site_size >= realloc_off + struct.calcsize(REALLOC_FMT):
+            old, copied, *counts = struct.unpack_from(REALLOC_FMT, data,
+                                                      off + realloc_off)
+            if any(counts):
+                site["realloc"] = {"old_bytes": old, "copied": copied,
+                                   "counts": dict(zip(REALLOC_KINDS, counts))}
+                site["est_copied"] = est_copied(site)
+        calloc_off = realloc_off + struct.calcsize(REALLOC_FMT)
+        if site_size >= calloc_off + struct.calcsize(CALLOC_FMT):
+            cleared, n, zeroed = struct.unpack_from(CALLOC_FMT, data,
+                                                    off + calloc_off)
+            if n:
+                site["calloc"] = {"cleared": cleared, "samples": n,
+                                  "zeroed": zeroed}
+                site["est_cleared"] = (cleared * site["est_bytes"]
+                                       // max(site["bytes"], 1))
+        resident_off = calloc_off + struct.calcsize(CALLOC_FMT)
+        if site_size >= resident_off + struct.calcsize(RESIDENT_FMT):
+            site["est_resident"], = struct.unpack_from(RESIDENT_FMT, data,
+                                                       off + resident_off)
+        sites.append(site)
+        off += site_size
+    prof["sites"] = sites
+
+    for _ in range(n_sections):
+        tag, rec_size, n_recs = struct.unpack_from(SECTION_FMT, data, off)
+        off += struct.calcsize(SECTION_FMT)
+        recs = [data[off + i * rec_size: off + (i + 1) * rec_size]
+                for i in range(n_recs)]
+        prof["sections"][tag] = recs
+        off += rec_size * n_recs
+
+    labels = {}
+    for rec in prof["sections"].get(SECTION_LABELS, []):
+        label_id, _, key, value = struct.unpack_from(LABEL_FMT, rec)
+        labels[label_id] = (key.split(b"\0", 1)[0].decode("utf-8", "replace"),
+                            value.split(b"\0", 1)[0].decode("utf-8", "replace"))
+    prof["labels"] = labels
+
+    modules = {}
+    for rec in prof["sections"].get(SECTION_MODULES, []):
+        module_id, _, load_addr, path = struct.unpack_from(MODULE_FMT, rec)
+        modules[module_id] = path.split(b"\0", 1)[0].decode("utf-8", "replace")
+    prof["modules"] = modules
+
+    for rec in prof["sections"].get(SECTION_REGION, []):
+        name, alloc_bytes = struct.unpack_from(REGION_FMT, rec)
+        prof["region"] = {
+            "name": name.split(b"\0", 1)[0].decode("utf-8", "replace"),
+            "alloc_bytes": alloc_bytes,
+        }
+
+    for rec in prof["sections"].get(SECTION_LEAKS, []):
+        outstanding, untracked = struct.unpack_from(LEAKS_FMT, rec)
+        prof["leaks"] = {"outstanding": outstanding, "untracked": untracked}
+
+    for rec in prof["sections"].get(SECTION_LARGE, []):
+        threshold, alloc_bytes = struct.unpack_from(LARGE_FMT, rec)
+        prof["large"] = {"threshold": threshold, "alloc_bytes": alloc_bytes}
+
+    for rec in prof["sections"].get(SECTION_COLD, []):
+        prof["cold"] = dict(zip(
+            ("min_size", "age_ns", "scans", "aged", "aged_bytes"),
+            struct.unpack_from(COLD_FMT, rec)))
+
+    for rec in prof["sections"].get(SECTION_FSHARE, []):
+        prof["fshare"] = dict(zip(
+            ("line_size", "max_size", "events", "pair_overflow"),
+            struct.unpack_from(FSHARE_FMT, rec)))
+
+    # Pairs index the sites in file order; resolve them before any sort.
+    pairs = []
+    for rec in prof["sections"].get(SECTION_FSHARE_PAIRS, []):
+        a, b, events = struct.unpack_from(FSHARE_PAIR_FMT, rec)
+        pairs.append((sites[a] if a < len(sites) else None,
+                      sites[b] if b < len(sites) else None, events))
+    prof["fshare_pairs"] = pairs
+
+    for rec in prof["sections"].get(SECTION_NUMA, []):
+        nodes, single_node, other_bytes = struct.unpack_from(NUMA_FMT, rec)
+        prof["numa"] = {"nodes": nodes, "single_node": single_node,
+                        "other_bytes": other_bytes, "cpus": {}}
+    for rec in prof["sections"].get(SECTION_NUMA_SITES, []):
+        index, node, est = struct.unpack_from(NUMA_BYTES_FMT, rec)
+        if index < len(sites):
+            sites[index].setdefault("numa", {})[node] = est
+    for rec in prof["sections"].get(SECTION_NUMA_CPUS, []):
+        cpu_node, node, est = struct.unpack_from(NUMA_BYTES_FMT, rec)
+        prof["numa"]["cpus"].setdefault(cpu_node, {})[node] = est
+
+    free_bins = []
+    for rec in prof["sections"].get(SECTION_FREE_BINS, []):
+        owner, kind, index, count, chunk_size, nbytes = \
+            struct.unpack_from(FREE_BIN_FMT, rec)
+        free_bins.append({"owner": owner, "kind": kind, "bin": index,
+                          "count": count, "chunk_size": chunk_size,
+                          "bytes": nbytes})
+    if SECTION_FREE_BINS in prof["sections"]:
+        prof["free_bins"] = free_bins
+
+    for rec in prof["sections"].get(SECTION_PEAK, []):
+        live_bytes, captures = struct.unpack_from(PEAK_FMT, rec)
+        prof["peak"] = {"live_bytes": live_bytes, "captures": captures}
+
+    for rec in prof["sections"].get(SECTION_GROWTH, []):
+        seq, heap_bytes, prev_heap_bytes = struct.unpack_from(GROWTH_FMT, rec)
+        prof["growth"] = {"seq": seq, "heap_bytes": heap_bytes,
+                          "prev_heap_bytes": prev_heap_bytes}
+
+    return prof
+
+def site_key(prof, site):
+    """(module path, offset, label) identifies a site across runs."""
+    if site["module"]:
+        module = prof["modules"].get(site["module"], "?")
+    else:
+        module = None
+    return (module, site["offset"], label_name(prof, site["label"]))
+
+def site_location(prof, site, binary):
+    """Symbolize SITE: shared objects by their own path, the main
+    program (path "") with BINARY."""
+    module = prof["modules"].get(site["module"]) if site["module"] else None
+    if module:
+        return symbolize(site["offset"], module)
+    if module == "":
+        return symbolize(site["offset"], binary)
+    return symbolize(site["pc"], binary)
+
+def est_waste(site):
+    """Estimated bytes lost to internal fragmentation: the sampled
+    slack ratio (usable - requested) / requested applied to est_bytes."""
+    slack = site["usable_bytes"] - site["bytes"]
+    if site["bytes"] == 0:
+        return slack * site["est_bytes"] // max(site["usable_bytes"], 1)
+    return slack * site["est_bytes"] // site["bytes"]
+
+def est_copied(site):
+    """Estimated bytes copied by realloc.  Reallocs are sampled by their
+    new size, so the sampled copies are scaled like the new sizes."""
+    copied = site["realloc"]["copied"]
+    return copied * site["est_bytes"] // max(site["bytes"], 1)
+
+def realloc_summary(site):
+    r = site["realloc"]
+    parts = [f"{k}={n}" for k, n in r["counts"].items() if n]
+    resized = sum(n for k, n in r["counts"].items() if k != "new")
+    if r["old_bytes"] and resized:
+        # New size over old, per sampled resize: near 1 means the site
+        # grows its buffer by a constant, copying O(n^2) bytes in all.
+        grown = site["bytes"] * resized // max(site["samples"], 1)
+        parts.append(f"growth=x{grown / r['old_bytes']:.2f}")
+    parts.append(f"est_copied={site['est_copied']}")
+    return " ".join(parts)
+
+def numa_summary(by_node):
+    """'node<N>=bytes' for each node, pages not yet touched last."""
+    return " ".join(
+        f"{'untouched' if n == NUMA_UNTOUCHED else f'node{n}'}={b}"
+        for n, b in sorted(by_node.items()))
+
+def print_free_bins(bins, top):
+    # Thread caches are keyed by TID, arena lists by arena number.
+    tcaches, arenas = {}, {}
+    for b in bins:
+        owners = tcaches if FREE_KINDS[b["kind"]] == "tcache" else arenas
+        owners.setdefault(b["owner"], []).append(b)
+
+    def total(recs):
+        return sum(b["bytes"] for b in recs), sum(b["count"] for b in recs)
+
+    cached = sum(total(recs)[0] for recs in tcaches.values())
+    print(f"Thread caches ({len(tcaches)} threads, {cached} bytes; "
+          f"large bins counted at their smallest chunk):")
+    ranked = sorted(tcaches.items(), key=lambda kv: -total(kv[1])[0])
+    for tid, recs in ranked[:top]:
+        nbytes, count = total(recs)
+        print(f"  tid={tid} bytes={nbytes} chunks={count}")
+        print("    " + " ".join(f"{b['chunk_size']}x{b['count']}"
+                                for b in recs))
+
+    print(f"Arena free lists ({len(arenas)} arenas):")
+    for nr, recs in sorted(arenas.items()):
+        nbytes, count = total(recs)
+        print(f"  arena {nr} bytes={nbytes} chunks={count}")
+        by_kind = {}
+        for b in recs:
+            k = FREE_KINDS[b["kind"]]
+            by_kind[k] = by_kind.get(k, 0) + b["bytes"]
+        print("    " + " ".join(f"{k}={v}" for k, v in by_kind.items()))
+
+def hist_bucket_min(i):
+    """Smallest request size counted in histogram bucket I."""
+    return 16 * i if i < 8 else 1 << (i - 1)
+
+def fmt_size(n):
+    for unit in ("", "K", "M"):
+        if n < 1024 or n % 1024:
+            return f"{n}{unit}"
+        n //= 1024
+    return f"{n}G"
+
+def hist_summary(hist):
+    """'[lo, hi): share' for each non-empty bucket."""
+    total = sum(hist)
+    parts = []
+    for i, n in enumerate(hist):
+        if not n:
+            continue
+        lo = fmt_size(hist_bucket_min(i))
+        hi = fmt_size(hist_bucket_min(i + 1)) if i + 1 < len(hist) else ""
+        parts.append(f"[{lo},{hi}):{100 * n / total:.0f}%")
+    return " ".join(parts)
+
+def label_name(prof, label_id):
+    if label_id == 0:
+        return ""
+    key, value = prof["labels"].get(label_id, (f"#{label_id}", ""))
+    return f"{key}={value}"
+
+def read_profile(path, binary=None, top=20, hist=False, sort="bytes"):
+    prof = parse_profile(path)
+    stride = prof["stride"]
+
+    print(f"File: {path}")
+    print(f"  version       = {prof['version']}")
+    print(f"  stride_bytes  = {stride}")
+    print(f"  alloc_count   = {prof['alloc_count']}")
+    print(f"  sample_count  = {prof['sample_count']}")
+    print(f"  site_overflow = {prof['overflow']}")
+    print(f"  n_sites       = {len(prof['sites'])}")
+    print(f"  est_bytes     = {prof['est_bytes']}")
+    for name, value in prof.get("overhead", {}).items():
+        print(f"  {name:<13} = {value}")
+    if "region" in prof:
+        print(f"  region        = {prof['region']['name']}")
+        print(f"  alloc_bytes   = {prof['region']['alloc_bytes']} (exact)")
+    if "large" in prof:
+        threshold = prof["large"]["threshold"] or "mmap threshold"
+        print(f"  large_bytes   = {threshold} (every allocation this size "
+              f"or larger, recorded exactly)")
+        print(f"  alloc_bytes   = {prof['large']['alloc_bytes']} (exact)")
+    if "cold" in prof:
+        c = prof["cold"]
+        print(f"  cold_min_size = {c['min_size']}")
+        print(f"  cold_age      = {c['age_ns'] / 1e9:g}s ({c['scans']} scans)")
+        print(f"  aged          = {c['aged']} sampled allocations, "
+              f"est_bytes={c['aged_bytes']} (cold or not)")
+    if "fshare" in prof:
+        f = prof["fshare"]
+        print(f"  fshare_max    = {f['max_size']} (line size {f['line_size']})")
+        print(f"  shared_lines  = {f['events']} found shared across threads "
+              f"({f['pair_overflow']} not attributed to a pair)")
+    if "numa" in prof:
+        nm = prof["numa"]
+        print(f"  numa_nodes    = {nm['nodes']}"
+              + (" (no node information: all on node 0)"
+                 if nm["single_node"] else ""))
+        print(f"  other_bytes   = {nm['other_bytes']}")
+        for cpu_node, by_node in sorted(nm["cpus"].items()):
+            print(f"  cpu node{cpu_node:<5} = {numa_summary(by_node)}")
+    if "leaks" in prof:
+        print(f"  outstanding   = {prof['leaks']['outstanding']} sampled "
+              f"allocations live at exit")
+        print(f"  untracked     = {prof['leaks']['untracked']}")
+    if "peak" in prof:
+        print(f"  peak_bytes    = {prof['peak']['live_bytes']} "
+              f"(estimated live, snapshot {prof['peak']['captures']})")
+    if "growth" in prof:
+        g = prof["growth"]
+        print(f"  growth_seq    = {g['seq']}")
+        print(f"  heap_bytes    = {g['heap_bytes']} "
+              f"(previous snapshot {g['prev_heap_bytes']})")
+
+    if "free_bins" in prof:
+        print_free_bins(prof["free_bins"], top)
+        return
 
-        print(f"File: {path}")
-        print(f"  stride_bytes  = {stride}")
-        print(f"  alloc_count   = {alloc_count}")
-        print(f"  sample_count  = {sample_count}")
-        print(f"  site_overflow = {overflow}")
-        print(f"  n_sites       = {n_sites}")
+    live_set = any(k in prof for k in LIVE_SET_SECTIONS)
+    if live_set and "est_resident" in (prof["sites"] or [{}])[0]:
+        print(f"  est_resident  = "
+              f"{sum(s['est_resident'] for s in prof['sites'])}")
 
+    changes = prof["sections"].get(SECTION_STRIDE_LOG, [])
+    if changes:
+        print(f"Stride changes (last {len(changes)}):")
+        for rec in changes:
+            time_ns, new_stride = struct.unpack_from("<Q Q", rec)
+            print(f"  t={time_ns / 1e9:.3f}s stride={new_stride}")
 
-        sites = []
-        for _ in range(n_sites):
-            site_raw = f.read(struct.calcsize(SITE_FMT))
-            pc, sample_cnt, total_bytes = struct.unpack(SITE_FMT, site_raw)
-            sites.append((total_bytes, sample_cnt, pc))
+    if prof["labels"]:
+        by_label = {}
+        for s in prof["sites"]:
+            by_label[s["label"]] = by_label.get(s["label"], 0) + s["est_bytes"]
+        print("Estimated bytes by label:")
+        for label_id, est in sorted(by_label.items(), key=lambda kv: -kv[1]):
+            print(f"  {label_name(prof, label_id) or '(none)'}: {est}")
 
-        # Sort sites by total sampled bytes (descending)
-        sites.sort(reverse=True)
+    sites = prof["sites"]
+    # Sort sites by estimated bytes (descending).  With an adaptive stride
+    # each sample is weighted by the stride in effect when it was taken.
+    if sort == "waste":
+        sites.sort(key=lambda s: s.get("est_waste", 0), reverse=True)
+        what = "wasted"
+    elif sort == "copied":
+        sites.sort(key=lambda s: s.get("est_copied", 0), reverse=True)
+        what = "realloc-copied"
+    elif sort == "cleared":
+        sites.sort(key=lambda s: s.get("est_cleared", 0), reverse=True)
+        what = "calloc-zeroed"
+    elif sort == "resident":
+        sites.sort(key=lambda s: s.get("est_resident", 0), reverse=True)
+        what = "resident"
+    else:
+        sites.sort(key=lambda s: s["est_bytes"], reverse=True)
+        what = "large" if "large" in prof else \
+               "line-sharing" if "fshare" in prof else \
+               "cold" if "cold" in prof else \
+               "live" if "numa" in prof else \
+               "leaked" if "leaks" in prof else \
+               "live" if "peak" in prof or "growth" in prof else "total"
+    print(f"Top {min(top, len(sites))} sites by estimated {what} bytes:")
 
-        print(f"Top {min(top, len(sites))} sites by estimated total bytes:")
+    for s in sites[:top]:
+        loc = site_location(prof, s, binary)
+        module, offset, _ = site_key(prof, s)
+        where = f"pc={hex(s['pc'])}" if module is None else \
+                f"{os.path.basename(module) or '<main>'}+{hex(offset)}"
+        line = (f"  {where} est_bytes={s['est_bytes']} "
+                f"bytes={s['bytes']} samples={s['samples']}")
+        if live_set and "est_resident" in s:
+            line += f" est_resident={s['est_resident']}"
+        if "est_waste" in s:
+            line += (f" slack={s['usable_bytes'] - s['bytes']}"
+                     f" est_waste={s['est_waste']}")
+        if s["label"]:
+            line += f" label={label_name(prof, s['label'])}"
+        if loc:
+            line += f" {loc}"
+        print(line)
+        if "realloc" in s:
+            print(f"    realloc: {realloc_summary(s)}")
+        if "numa" in s:
+            print(f"    numa: {numa_summary(s['numa'])}")
+        if "calloc" in s:
+            c = s["calloc"]
+            print(f"    calloc: samples={c['samples']} zeroed={c['zeroed']} "
+                  f"est_cleared={s['est_cleared']}")
+        if hist and s.get("hist") and any(s["hist"]):
+            print(f"    sizes: {hist_summary(s['hist'])}")
 
-        for total_bytes, sample_cnt, pc in sites[:top]:
-            # Estimated total allocated bytes at this site = sample_count * stride
-            estimated = sample_cnt * stride
-            loc = symbolize(pc, binary)
-            print(f"  pc={hex(pc)} est_bytes={estimated} bytes={total_bytes} samples={sample_cnt}")
+    pairs = prof["fshare_pairs"]
+    if pairs:
+        print(f"Top {min(top, len(pairs))} site pairs sharing cache lines "
+              f"across threads:")
+    for a, b, events in pairs[:top]:
+        names = []
+        for s in (a, b):
+            if s is None:
+                names.append("(site overflow)")
+                continue
+            module, offset, label = site_key(prof, s)
+            where = f"pc={hex(s['pc'])}" if module is None else \
+                    f"{os.path.basename(module) or '<main>'}+{hex(offset)}"
+            loc = site_location(prof, s, binary)
+            names.append(" ".join(x for x in (where, label, loc) if x))
+        print(f"  lines={events} {names[0]} <-> {names[1]}")
 
 def main():
     ap = argparse.ArgumentParser()
     ap.add_argument("file", help="profile .bin file")
     ap.add_argument("-e", "--binary", help="path to executable for symbolization")
     ap.add_argument("--top", type=int, default=20)
+    ap.add_argument("--hist", action="store_true",
+                    help="show each site's request-size histogram")
+    ap.add_argument("--sort",
+                    choices=("bytes", "waste", "copied", "cleared",
+                             "resident"),
+                    default="bytes",
+                    help="rank sites by estimated bytes, by estimated "
+                         "internal fragmentation, by bytes realloc "
+                         "copied, by bytes calloc zeroed or (live sets) "
+                         "by resident bytes")
     args = ap.parse_args()
-    read_profile(args.file, binary=args.binary, top=args.top)
+    read_profile(args.file, binary=args.binary, top=args.top, hist=args.hist,
+                 sort=args.sort)
 
 if __name__ == "__main__":
-    main()
\ No newline at end of file
+    main()